@@ -53,6 +53,7 @@ static const std::pair<nonstd::string_view, nonstd::string_view> help_items[] =
     {"F1", "Open the help screen"},
     {"F2", "Select a MIDI device for playback"},
     {"F3", "Select a synthesizer device for playback"},
+    {"Shift F3", "Reload the synthesizer configuration"},
     {"F4", "Configure global audio effects"},
     {"F9", "Select a theme for the user interface"},
     {"F12", "Open the configuration directory"},
@@ -423,7 +424,14 @@ void Application::paint_scaled(SDL_Renderer *rr, int paint, unsigned scale)
     if (paint & Pt_Foreground) {
         SDLpp_SaveClipState(rr, clip);
         SDL_RenderSetClipRect(rr, &lo.playing_value.bounds);
-        draw_text_rect(lo.playing_value, path_file_name(ps.file_path), pal[Colors::text_high_brightness]);
+        std::string playing_text(path_file_name(ps.file_path));
+        if (ps.synth_preload_progress >= 0)
+            playing_text += " (loading " + std::to_string(ps.synth_preload_progress) + "%)";
+        if (ps.audio_stats.xruns > 0)
+            playing_text += " [xruns: " + std::to_string(ps.audio_stats.xruns) + "]";
+        if (ps.audio_device_lost)
+            playing_text += " [audio device lost]";
+        draw_text_rect(lo.playing_value, playing_text, pal[Colors::text_high_brightness]);
         SDLpp_RestoreClipState(rr, clip);
     }
     if (paint & Pt_Background) {
@@ -841,6 +849,10 @@ bool Application::handle_key_pressed(const SDL_KeyboardEvent &event)
             choose_synth(true, last_synth_choice_);
             return true;
         }
+        else if ((keymod & KMOD_SHIFT) && !(keymod & ~KMOD_SHIFT)) {
+            reload_synth_options();
+            return true;
+        }
         break;
     case SDL_SCANCODE_F4:
         if (keymod == KMOD_NONE) {
@@ -1548,6 +1560,12 @@ void Application::choose_synth(bool ask, nonstd::string_view choice)
     }
 }
 
+void Application::reload_synth_options()
+{
+    std::unique_ptr<Pcmd_Reload_Synth_Options> cmd(new Pcmd_Reload_Synth_Options);
+    player_->push_command(std::move(cmd));
+}
+
 void Application::get_midi_outputs(std::vector<Midi_Output> &outputs)
 {
     std::unique_ptr<Pcmd_Get_Midi_Outputs> cmd(new Pcmd_Get_Midi_Outputs);
@@ -1765,13 +1783,43 @@ std::unique_ptr<CSimpleIniA> Application::initialize_config()
         ini_update = true;
     }
 
+    if (!ini->GetValue("", "audio-device")) {
+        ini->SetValue("", "audio-device", "auto", "; Audio output system, or a null output for benchmarking [auto;null;null-freerunning]");
+        ini_update = true;
+    }
+
     if (!ini->GetValue("", "synth-sample-rate")) {
         ini->SetDoubleValue("", "synth-sample-rate", 44100, "; Sample rate of synthesized audio stream (Hz) [22050:192000]");
         ini_update = true;
     }
 
     if (!ini->GetValue("", "synth-audio-latency")) {
-        ini->SetDoubleValue("", "synth-audio-latency", 50, "; Latency of synthesized audio stream (ms) [1:500]");
+        ini->SetDoubleValue("", "synth-audio-latency", 50, "; Latency of synthesized audio stream (ms), or auto to adapt it to the load [1:500;auto]");
+        ini_update = true;
+    }
+
+    if (!ini->GetValue("", "synth-render-rate")) {
+        ini->SetValue("", "synth-render-rate", "device", "; Sample rate of the synth, converted to the rate of the audio stream [device;native;8000:192000]");
+        ini_update = true;
+    }
+
+    if (!ini->GetValue("", "synth-resampler-quality")) {
+        ini->SetValue("", "synth-resampler-quality", "medium", "; Quality of the conversion from the sample rate of the synth [fast;medium;best]");
+        ini_update = true;
+    }
+
+    if (!ini->GetValue("", "synth-channel-outputs")) {
+        ini->SetBoolValue("", "synth-channel-outputs", false, "; Output the MIDI channels separately, if the audio system and the synth support it (JACK)");
+        ini_update = true;
+    }
+
+    if (!ini->GetValue("", "realtime-priority")) {
+        ini->SetLongValue("", "realtime-priority", 70, "; Real-time priority of the audio threads, or 0 to disable [0:99]");
+        ini_update = true;
+    }
+
+    if (!ini->GetValue("", "lock-memory")) {
+        ini->SetBoolValue("", "lock-memory", false, "; Keep all memory resident, to avoid page faults in the audio threads");
         ini_update = true;
     }
 
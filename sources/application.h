@@ -77,6 +77,7 @@ public:
     void open_fx_dialog();
     void choose_midi_output(bool ask, nonstd::string_view choice);
     void choose_synth(bool ask, nonstd::string_view choice);
+    void reload_synth_options();
     void get_midi_outputs(std::vector<Midi_Output> &outputs);
 
     void choose_theme(nonstd::string_view choice);
@@ -0,0 +1,124 @@
+//          Copyright Jean Pierre Cimalando 2019-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "audio/resampler.h"
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    for (unsigned k = 1; k < 32; ++k) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+void resampler_polyphase::init(double input_rate, double output_rate, quality q, size_t max_output)
+{
+    switch (q) {
+    case fast: taps_ = 8; phases_ = 64; break;
+    default: taps_ = 16; phases_ = 256; break;
+    case best: taps_ = 32; phases_ = 1024; break;
+    }
+
+    step_ = input_rate / output_rate;
+
+    // cut below the lower of the two Nyquist frequencies, by a margin which
+    //   is as narrow as the length of the filter permits
+    const double beta = 6.0;
+    const double transition = 4.0 / taps_;
+    const double cutoff = std::min(1.0, output_rate / input_rate) * (1.0 - 0.5 * transition);
+    const double center = taps_ / 2 - 1;
+
+    coefs_.assign(2 * taps_ * (phases_ + 1), 0.0f);
+    for (unsigned p = 0; p <= phases_; ++p) {
+        float *c = &coefs_[2 * taps_ * p];
+        double frac = (double)p / phases_;
+        double sum = 0;
+        for (unsigned j = 0; j < taps_; ++j) {
+            double t = j - center - frac;
+            double x = cutoff * t;
+            double sinc = (x == 0) ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+            double r = t / (taps_ / 2);
+            double window = (std::fabs(r) < 1) ? bessel_i0(beta * std::sqrt(1 - r * r)) / bessel_i0(beta) : 0.0;
+            double h = sinc * window;
+            c[2 * j] = (float)h;
+            sum += h;
+        }
+        for (unsigned j = 0; j < taps_; ++j)
+            c[2 * j + 1] = c[2 * j] = (float)(c[2 * j] / sum);
+    }
+
+    max_input_ = (size_t)std::ceil(max_output * step_) + 2;
+    history_.assign(2 * (taps_ + max_input_), 0.0f);
+    clear();
+}
+
+void resampler_polyphase::clear()
+{
+    // start centered on the filter, after some frames of silence
+    history_frames_ = taps_ / 2 - 1;
+    std::fill(history_.begin(), history_.begin() + 2 * history_frames_, 0.0f);
+    pos_ = 0;
+}
+
+size_t resampler_polyphase::input_frames_for(size_t output_frames) const
+{
+    if (output_frames == 0)
+        return 0;
+
+    size_t last = (size_t)(pos_ + (output_frames - 1) * step_);
+    size_t needed = last + taps_;
+    return (needed > history_frames_) ? (needed - history_frames_) : 0;
+}
+
+void resampler_polyphase::process(const float *input, size_t input_frames, float *output, size_t output_frames)
+{
+    const unsigned taps = taps_;
+    const unsigned phases = phases_;
+    float *history = history_.data();
+
+    std::memcpy(history + 2 * history_frames_, input, 2 * input_frames * sizeof(float));
+    history_frames_ += input_frames;
+
+    double pos = pos_;
+    for (size_t k = 0; k < output_frames; ++k) {
+        size_t index = (size_t)pos;
+        unsigned phase = (unsigned)std::lround((pos - index) * phases);
+        const float *c = &coefs_[2 * taps * phase];
+        const float *x = history + 2 * index;
+#if defined(__SSE__)
+        __m128 acc = _mm_setzero_ps();
+        for (unsigned j = 0; j < 2 * taps; j += 4)
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(c + j), _mm_loadu_ps(x + j)));
+        acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+        float lr[4];
+        _mm_storeu_ps(lr, acc);
+        output[2 * k] = lr[0];
+        output[2 * k + 1] = lr[1];
+#else
+        float l = 0, r = 0;
+        for (unsigned j = 0; j < taps; ++j) {
+            l += c[2 * j] * x[2 * j];
+            r += c[2 * j + 1] * x[2 * j + 1];
+        }
+        output[2 * k] = l;
+        output[2 * k + 1] = r;
+#endif
+        pos += step_;
+    }
+
+    // drop the input which the next outputs do not need
+    size_t consumed = std::min((size_t)pos, history_frames_);
+    std::memmove(history, history + 2 * consumed, 2 * (history_frames_ - consumed) * sizeof(float));
+    history_frames_ -= consumed;
+    pos_ = pos - consumed;
+}
@@ -0,0 +1,38 @@
+//          Copyright Jean Pierre Cimalando 2019-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <vector>
+#include <cstddef>
+
+/**
+ * Polyphase windowed-sinc resampler for interleaved stereo, which converts at
+ * any ratio. The caller asks how much input the next block needs, then
+ * supplies exactly that amount.
+ */
+class resampler_polyphase {
+public:
+    enum quality { fast, medium, best };
+
+    void init(double input_rate, double output_rate, quality q, size_t max_output);
+    void clear();
+
+    size_t input_frames_for(size_t output_frames) const;
+    void process(const float *input, size_t input_frames, float *output, size_t output_frames);
+
+    size_t max_input_frames() const noexcept { return max_input_; }
+
+private:
+    unsigned taps_ = 0;
+    unsigned phases_ = 0;
+    double step_ = 0;
+    double pos_ = 0;
+    size_t max_input_ = 0;
+    // coefficients for each phase, each one doubled for both channels
+    std::vector<float> coefs_;
+    // input frames, starting from the oldest still needed
+    std::vector<float> history_;
+    size_t history_frames_ = 0;
+};
@@ -9,6 +9,8 @@
 #include "adev_jack.h"
 #include "adev_soundio.h"
 #include "adev_rtaudio.h"
+#include "adev_null.h"
+#include "utility/thread_priority.h"
 #include <memory>
 #include <cstring>
 
@@ -42,20 +44,98 @@ Audio_Device *Audio_Device::create_best_for_system()
     return adev.release();
 }
 
+Audio_Device *Audio_Device::create_by_name(nonstd::string_view name)
+{
+    if (name == "null")
+        return new Audio_Device_Null;
+    if (name == "null-freerunning")
+        return new Audio_Device_Null(true);
+
+    return create_best_for_system();
+}
+
+Audio_Device::~Audio_Device()
+{
+}
+
 void Audio_Device::set_callback(audio_callback_t *cb, void *cbdata)
 {
     std::lock_guard<std::mutex> lock(cbmutex_);
 
-    cb_ = cb;
-    cbdata_ = cbdata;
+    std::unique_ptr<Callback> callback;
+    if (cb) {
+        callback.reset(new Callback);
+        callback->cb = cb;
+        callback->cbdata = cbdata;
+    }
+
+    current_callback_.store(callback.get());
+
+    // the counter is odd while a cycle is in progress, wait for it to end
+    unsigned long counter = cycle_counter_.load();
+    if (counter & 1) {
+        while (cycle_counter_.load() == counter)
+            std::this_thread::yield();
+    }
+
+    callback_ = std::move(callback);
 }
 
-void Audio_Device::process_cycle(float *output, unsigned nframes)
+void Audio_Device::set_reconfigure_callback(reconfigure_callback_t *cb, void *cbdata)
 {
-    std::unique_lock<std::mutex> lock(cbmutex_, std::try_to_lock);
+    std::lock_guard<std::mutex> lock(rcmutex_);
+
+    rccb_ = cb;
+    rccbdata_ = cbdata;
+}
 
-    if (lock.owns_lock() && cb_)
-        cb_(reinterpret_cast<float *>(output), nframes, cbdata_);
-    else
+void Audio_Device::notify_reconfigure()
+{
+    std::lock_guard<std::mutex> lock(rcmutex_);
+
+    if (rccb_)
+        rccb_(rccbdata_);
+}
+
+void Audio_Device::process_cycle(float *output, unsigned nframes, float *const *channels)
+{
+    Audio_Stats_Collector::clock::time_point start = begin_period();
+    process_part(output, nframes, channels);
+    end_period(start, nframes);
+}
+
+Audio_Stats_Collector::clock::time_point Audio_Device::begin_period()
+{
+    // promote the thread of the audio system when it first calls in
+    if (rt_priority_ > 0 && rt_thread_ != std::this_thread::get_id()) {
+        rt_thread_ = std::this_thread::get_id();
+        if (needs_realtime_thread() && !has_realtime_thread())
+            set_thread_realtime(rt_priority_);
+    }
+
+    return Audio_Stats_Collector::clock::now();
+}
+
+void Audio_Device::process_part(float *output, unsigned nframes, float *const *channels)
+{
+    cycle_counter_.fetch_add(1);
+
+    const Callback *callback = current_callback_.load();
+    if (callback)
+        callback->cb(output, channels, nframes, callback->cbdata);
+    else {
         std::memset(output, 0, 2 * nframes * sizeof(float));
+        for (unsigned i = 0; channels && i < 2 * midi_channel_count; ++i) {
+            if (channels[i])
+                std::memset(channels[i], 0, nframes * sizeof(float));
+        }
+        silence_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    cycle_counter_.fetch_add(1, std::memory_order_release);
+}
+
+void Audio_Device::end_period(Audio_Stats_Collector::clock::time_point start, unsigned nframes)
+{
+    stats_.record_cycle(start, Audio_Stats_Collector::clock::now(), nframes, sample_rate());
 }
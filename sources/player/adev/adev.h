@@ -4,29 +4,81 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #pragma once
+#include "adev_stats.h"
+#include <nonstd/string_view.hpp>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <atomic>
 
 class Audio_Device {
 public:
-    virtual ~Audio_Device() {}
+    virtual ~Audio_Device();
 
     static Audio_Device *create_best_for_system();
+    static Audio_Device *create_by_name(nonstd::string_view name);
     virtual const char *audio_system_name() const noexcept = 0;
 
-    typedef void (audio_callback_t)(float *output, unsigned nframes, void *user_data);
+    enum { midi_channel_count = 16 };
+
+    // channels: planar stereo pairs of the MIDI channels, for the devices
+    //   which output them separately, null when not in use
+    typedef void (audio_callback_t)(float *output, float *const *channels, unsigned nframes, void *user_data);
+    typedef void (reconfigure_callback_t)(void *user_data);
 
     virtual bool init(double desired_sample_rate, double desired_latency) = 0;
     virtual void shutdown() = 0;
     void set_callback(audio_callback_t *cb, void *cbdata);
+    void set_reconfigure_callback(reconfigure_callback_t *cb, void *cbdata);
+    void set_realtime_priority(int priority) { rt_priority_ = priority; }
+    void request_channel_outputs(bool request) { channel_outputs_requested_ = request; }
     virtual bool start() = 0;
     virtual double latency() const = 0;
     virtual double sample_rate() const = 0;
+    // whether the latency asked to init is honored, rather than imposed by the system
+    virtual bool can_set_latency() const noexcept { return true; }
+
+    // number of cycles which were filled with silence, for lack of a callback
+    unsigned long silence_count() const noexcept { return silence_count_.load(std::memory_order_relaxed); }
+    Audio_Device_Stats stats() const { return stats_.snapshot(); }
 
 protected:
-    void process_cycle(float *output, unsigned nframes);
-    std::mutex cbmutex_;
+    // whether the audio system runs the callback in real time by itself
+    virtual bool has_realtime_thread() const noexcept { return false; }
+    // whether the callback has real-time deadlines, which warrant promoting
+    //   the thread it runs in
+    virtual bool needs_realtime_thread() const noexcept { return true; }
+    void process_cycle(float *output, unsigned nframes, float *const *channels = nullptr);
+    // a period which the device renders in several parts, all of them
+    //   between the beginning and the end, to count as a single cycle
+    Audio_Stats_Collector::clock::time_point begin_period();
+    void process_part(float *output, unsigned nframes, float *const *channels = nullptr);
+    void end_period(Audio_Stats_Collector::clock::time_point start, unsigned nframes);
+    bool channel_outputs_requested() const noexcept { return channel_outputs_requested_; }
+    // the rate or the latency changed while running
+    void notify_reconfigure();
+    // the audio system signaled an underrun or an overrun
+    void report_xrun() { stats_.record_xrun(); }
 
 private:
-    audio_callback_t *cb_ = nullptr;
-    void *cbdata_ = nullptr;
+    struct Callback {
+        audio_callback_t *cb = nullptr;
+        void *cbdata = nullptr;
+    };
+
+    // the audio thread reads the callback without locking, and a replaced
+    // callback is retired after the cycle which may still use it has ended
+    std::mutex cbmutex_;
+    std::unique_ptr<Callback> callback_;
+    std::atomic<Callback *> current_callback_{nullptr};
+    std::atomic<unsigned long> cycle_counter_{0};
+    std::atomic<unsigned long> silence_count_{0};
+    Audio_Stats_Collector stats_;
+
+    std::mutex rcmutex_;
+    reconfigure_callback_t *rccb_ = nullptr;
+    void *rccbdata_ = nullptr;
+    int rt_priority_ = 0;
+    bool channel_outputs_requested_ = false;
+    std::thread::id rt_thread_;
 };
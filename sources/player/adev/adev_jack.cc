@@ -9,7 +9,12 @@
 #include <nonstd/scope.hpp>
 #include <nonstd/string_view.hpp>
 #include <cmath>
+#include <algorithm>
 #include <cstring>
+#include <cstdio>
+
+// the scratch buffer never gets reallocated, larger periods render in pieces
+static constexpr jack_nframes_t min_buffer_capacity = 1024;
 
 bool Audio_Device_Jack::is_available()
 {
@@ -32,17 +37,35 @@ bool Audio_Device_Jack::init(double desired_sample_rate, double desired_latency)
             return false;
     }
 
-    jack_set_process_callback(client.get(), &jack_audio_callback, this);
+    have_channel_ports_ = false;
+    if (channel_outputs_requested()) {
+        for (unsigned i = 0; i < 2 * midi_channel_count; ++i) {
+            char name[32];
+            sprintf(name, "channel_%02u_%c", i / 2 + 1, (i & 1) ? 'R' : 'L');
+            channel_ports_[i] = jack_port_register(client.get(), name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+            if (!channel_ports_[i])
+                return false;
+        }
+        have_channel_ports_ = true;
+    }
 
     double audio_rate = jack_get_sample_rate(client.get());
     jack_nframes_t audio_buffer_size = jack_get_buffer_size(client.get());
 
-    buffer_.reset(new float[2 * audio_buffer_size]);
+    buffer_capacity_ = std::max(audio_buffer_size, min_buffer_capacity);
+    buffer_.reset(new float[2 * buffer_capacity_]);
 
-    client_ = std::move(client);
     audio_rate_ = audio_rate;
     audio_latency_ = audio_buffer_size / audio_rate;
 
+    // the server may invoke these at once, with the values known already
+    jack_set_process_callback(client.get(), &jack_audio_callback, this);
+    jack_set_buffer_size_callback(client.get(), &jack_buffer_size_callback, this);
+    jack_set_sample_rate_callback(client.get(), &jack_sample_rate_callback, this);
+    jack_set_xrun_callback(client.get(), &jack_xrun_callback, this);
+
+    client_ = std::move(client);
+
     identify_physical_ports();
 
     return true;
@@ -84,18 +107,84 @@ int Audio_Device_Jack::jack_audio_callback(jack_nframes_t nframes, void *user_da
     Audio_Device_Jack *self = reinterpret_cast<Audio_Device_Jack *>(user_data);
 
     float *buffer = self->buffer_.get();
-    self->process_cycle(buffer, nframes);
+    const jack_nframes_t capacity = self->buffer_capacity_;
 
     float *out1 = reinterpret_cast<float *>(jack_port_get_buffer(self->ports_[0], nframes));
     float *out2 = reinterpret_cast<float *>(jack_port_get_buffer(self->ports_[1], nframes));
-    for (jack_nframes_t i = 0; i < nframes; ++i) {
-        out1[i] = buffer[2 * i];
-        out2[i] = buffer[2 * i + 1];
+
+    // the channels are rendered straight into the ports which are connected
+    const unsigned channel_count = 2 * midi_channel_count;
+    float *channels[channel_count] {};
+    bool have_channels = false;
+    if (self->have_channel_ports_) {
+        for (unsigned c = 0; c < channel_count; c += 2) {
+            jack_port_t *left = self->channel_ports_[c];
+            jack_port_t *right = self->channel_ports_[c + 1];
+            if (jack_port_connected(left) || jack_port_connected(right)) {
+                channels[c] = reinterpret_cast<float *>(jack_port_get_buffer(left, nframes));
+                channels[c + 1] = reinterpret_cast<float *>(jack_port_get_buffer(right, nframes));
+                have_channels = true;
+            }
+        }
+    }
+
+    // the statistics see one cycle per period, however it is divided
+    Audio_Stats_Collector::clock::time_point start = self->begin_period();
+
+    for (jack_nframes_t index = 0; index < nframes;) {
+        jack_nframes_t count = std::min(capacity, nframes - index);
+        float *chunk_channels[channel_count];
+        for (unsigned c = 0; c < channel_count; ++c)
+            chunk_channels[c] = channels[c] ? (channels[c] + index) : nullptr;
+        self->process_part(buffer, count, have_channels ? chunk_channels : nullptr);
+        for (jack_nframes_t i = 0; i < count; ++i) {
+            out1[index + i] = buffer[2 * i];
+            out2[index + i] = buffer[2 * i + 1];
+        }
+        index += count;
+    }
+
+    self->end_period(start, nframes);
+
+    return 0;
+}
+
+int Audio_Device_Jack::jack_buffer_size_callback(jack_nframes_t nframes, void *user_data)
+{
+    Audio_Device_Jack *self = reinterpret_cast<Audio_Device_Jack *>(user_data);
+
+    double audio_latency = nframes / self->audio_rate_.load();
+    if (self->audio_latency_.exchange(audio_latency) != audio_latency) {
+        Log::i("JACK buffer size: %u frames", (unsigned)nframes);
+        self->notify_reconfigure();
+    }
+
+    return 0;
+}
+
+int Audio_Device_Jack::jack_sample_rate_callback(jack_nframes_t nframes, void *user_data)
+{
+    Audio_Device_Jack *self = reinterpret_cast<Audio_Device_Jack *>(user_data);
+
+    double audio_rate = nframes;
+    double old_rate = self->audio_rate_.exchange(audio_rate);
+    if (old_rate != audio_rate) {
+        jack_nframes_t buffer_size = jack_get_buffer_size(self->client_.get());
+        self->audio_latency_ = buffer_size / audio_rate;
+        Log::i("JACK sample rate: %u Hz", (unsigned)nframes);
+        self->notify_reconfigure();
     }
 
     return 0;
 }
 
+int Audio_Device_Jack::jack_xrun_callback(void *user_data)
+{
+    Audio_Device_Jack *self = reinterpret_cast<Audio_Device_Jack *>(user_data);
+    self->report_xrun();
+    return 0;
+}
+
 void Audio_Device_Jack::connect_physical_ports()
 {
     jack_client_t *client = client_.get();
@@ -10,6 +10,7 @@
 #include <list>
 #include <array>
 #include <memory>
+#include <atomic>
 
 class Audio_Device_Jack : public Audio_Device {
 public:
@@ -22,9 +23,16 @@ public:
     bool start() override;
     double latency() const override;
     double sample_rate() const override;
+    bool can_set_latency() const noexcept override { return false; }
+
+protected:
+    bool has_realtime_thread() const noexcept override { return true; }
 
 private:
     static int jack_audio_callback(jack_nframes_t nframes, void *user_data);
+    static int jack_buffer_size_callback(jack_nframes_t nframes, void *user_data);
+    static int jack_sample_rate_callback(jack_nframes_t nframes, void *user_data);
+    static int jack_xrun_callback(void *user_data);
     void connect_physical_ports();
 
     typedef std::array<std::list<std::string>, 2> Connections;
@@ -38,9 +46,13 @@ private:
 
 private:
     std::array<jack_port_t *, 2> ports_ {};
+    // stereo pairs of the MIDI channels, if requested
+    std::array<jack_port_t *, 2 * midi_channel_count> channel_ports_ {};
+    bool have_channel_ports_ = false;
     std::unique_ptr<float[]> buffer_;
-    double audio_rate_ = 0.0;
-    double audio_latency_ = 0.0;
+    jack_nframes_t buffer_capacity_ = 0;
+    std::atomic<double> audio_rate_{0.0};
+    std::atomic<double> audio_latency_{0.0};
     jack_client_u client_;
     bool active_ = false;
 };
@@ -0,0 +1,117 @@
+//          Copyright Jean Pierre Cimalando 2019-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "adev_null.h"
+#include "utility/logs.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// interval between the reports of throughput
+static constexpr double report_interval = 10.0;
+
+Audio_Device_Null::Audio_Device_Null(bool freerunning)
+    : freerunning_(freerunning)
+{
+}
+
+Audio_Device_Null::~Audio_Device_Null()
+{
+    shutdown();
+}
+
+bool Audio_Device_Null::init(double desired_sample_rate, double desired_latency)
+{
+    shutdown();
+
+    audio_rate_ = desired_sample_rate;
+    buffer_size_ = std::max(16u, (unsigned)std::ceil(desired_latency * desired_sample_rate));
+    buffer_.reset(new float[2 * buffer_size_]);
+
+    Log::i("Null audio: %s, %u frames per cycle",
+           freerunning_ ? "freerunning" : "paced to real time", buffer_size_);
+
+    return true;
+}
+
+void Audio_Device_Null::shutdown()
+{
+    if (thread_.joinable()) {
+        quit_.store(true);
+        thread_.join();
+        quit_.store(false);
+    }
+}
+
+bool Audio_Device_Null::start()
+{
+    if (thread_.joinable())
+        return true;
+
+    if (!buffer_)
+        return false;
+
+    thread_ = std::thread([this]() { thread_exec(); });
+    return true;
+}
+
+double Audio_Device_Null::latency() const
+{
+    return buffer_size_ / audio_rate_;
+}
+
+double Audio_Device_Null::sample_rate() const
+{
+    return audio_rate_;
+}
+
+void Audio_Device_Null::thread_exec()
+{
+    typedef std::chrono::steady_clock clock;
+
+    const unsigned nframes = buffer_size_;
+    const std::chrono::duration<double> period(nframes / audio_rate_);
+
+    const clock::time_point start = clock::now();
+    clock::time_point deadline = start;
+    clock::time_point last_report = start;
+    unsigned long long frames_done = 0;
+    unsigned long long frames_at_report = 0;
+
+    while (!quit_.load()) {
+        process_cycle(buffer_.get(), nframes);
+        frames_done += nframes;
+
+        clock::time_point now = clock::now();
+        std::chrono::duration<double> since_report = now - last_report;
+        if (since_report.count() >= report_interval) {
+            report_throughput((frames_done - frames_at_report) / audio_rate_, since_report.count());
+            last_report = now;
+            frames_at_report = frames_done;
+        }
+
+        if (!freerunning_) {
+            deadline += std::chrono::duration_cast<clock::duration>(period);
+            // if late, restart the pacing from now instead of catching up
+            if (deadline < now) {
+                report_xrun();
+                deadline = now;
+            }
+            std::this_thread::sleep_until(deadline);
+        }
+    }
+
+    std::chrono::duration<double> total = clock::now() - start;
+    report_throughput(frames_done / audio_rate_, total.count());
+}
+
+void Audio_Device_Null::report_throughput(double audio_time, double real_time)
+{
+    if (real_time <= 0)
+        return;
+
+    Log::i("Null audio: rendered %.1f s in %.1f s, %.2fx real time",
+           audio_time, real_time, audio_time / real_time);
+}
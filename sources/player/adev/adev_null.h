@@ -0,0 +1,45 @@
+//          Copyright Jean Pierre Cimalando 2019-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "adev.h"
+#include <thread>
+#include <atomic>
+#include <memory>
+
+/**
+ * Audio device which discards its output, for use without a sound card.
+ * The cycles are paced to real time, or run as fast as possible.
+ */
+class Audio_Device_Null : public Audio_Device {
+public:
+    explicit Audio_Device_Null(bool freerunning = false);
+    ~Audio_Device_Null();
+
+    const char *audio_system_name() const noexcept override { return "Null"; }
+
+    bool init(double desired_sample_rate, double desired_latency) override;
+    void shutdown() override;
+    bool start() override;
+    double latency() const override;
+    double sample_rate() const override;
+
+protected:
+    // no sound card waits for the output, and the freerunning mode would
+    //   keep a core busy at real-time priority
+    bool needs_realtime_thread() const noexcept override { return false; }
+
+private:
+    void thread_exec();
+    void report_throughput(double audio_time, double real_time);
+
+private:
+    bool freerunning_ = false;
+    double audio_rate_ = 0.0;
+    unsigned buffer_size_ = 0;
+    std::unique_ptr<float[]> buffer_;
+    std::thread thread_;
+    std::atomic_bool quit_{false};
+};
@@ -72,9 +72,11 @@ double Audio_Device_Rt::sample_rate() const
     return audio_rate_;
 }
 
-int Audio_Device_Rt::rtaudio_callback(void *output_buffer, void *, unsigned nframes, double, RtAudioStreamStatus, void *user_data)
+int Audio_Device_Rt::rtaudio_callback(void *output_buffer, void *, unsigned nframes, double, RtAudioStreamStatus status, void *user_data)
 {
     Audio_Device_Rt *self = reinterpret_cast<Audio_Device_Rt *>(user_data);
+    if (status & RTAUDIO_OUTPUT_UNDERFLOW)
+        self->report_xrun();
     self->process_cycle(reinterpret_cast<float *>(output_buffer), nframes);
     return 0;
 }
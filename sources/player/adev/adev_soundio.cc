@@ -61,6 +61,7 @@ bool Audio_Device_Soundio::init(double desired_sample_rate, double desired_laten
     outstream->software_latency = desired_latency;
     outstream->userdata = this;
     outstream->write_callback = &write_callback;
+    outstream->underflow_callback = &underflow_callback;
     outstream->name = PROGRAM_DISPLAY_NAME;
 
     err = soundio_outstream_open(outstream.get());
@@ -163,12 +164,20 @@ void Audio_Device_Soundio::write_callback(SoundIoOutStream *outstream, int frame
     }
 
     err = soundio_outstream_end_write(outstream);
-    if (err && err != SoundIoErrorUnderflow) {
+    if (err == SoundIoErrorUnderflow)
+        self->report_xrun();
+    else if (err) {
         Log::e("Unrecoverable audio stream error: %s", soundio_strerror(err));
         throw std::runtime_error("soundio_outstream_begin_write");
     }
 }
 
+void Audio_Device_Soundio::underflow_callback(SoundIoOutStream *outstream)
+{
+    Audio_Device_Soundio *self = reinterpret_cast<Audio_Device_Soundio *>(outstream->userdata);
+    self->report_xrun();
+}
+
 float *Audio_Device_Soundio::get_temp_buffer(unsigned nframes)
 {
     unsigned temp_frames_current = temp_frames_;
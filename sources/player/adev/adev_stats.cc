@@ -0,0 +1,82 @@
+//          Copyright Jean Pierre Cimalando 2019-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "adev_stats.h"
+#include <algorithm>
+#include <cmath>
+
+void Audio_Stats_Collector::record_cycle(clock::time_point start, clock::time_point end, unsigned nframes, double sample_rate)
+{
+    const std::memory_order mo = std::memory_order_relaxed;
+
+    const double duration = nframes / sample_rate;
+    const double load = (duration > 0) ? std::chrono::duration<double>(end - start).count() / duration : 0;
+    const unsigned long cycles = cycles_.load(mo);
+
+    if (cycles == 0) {
+        frames_min_.store(nframes, mo);
+        frames_max_.store(nframes, mo);
+        load_min_.store(load, mo);
+        load_max_.store(load, mo);
+    }
+    else {
+        frames_min_.store(std::min(frames_min_.load(mo), nframes), mo);
+        frames_max_.store(std::max(frames_max_.load(mo), nframes), mo);
+        load_min_.store(std::min(load_min_.load(mo), load), mo);
+        load_max_.store(std::max(load_max_.load(mo), load), mo);
+
+        double interval = std::chrono::duration<double>(start - last_start_).count();
+        double jitter = std::fabs(interval - last_duration_);
+        jitter_sum_.store(jitter_sum_.load(mo) + jitter, mo);
+        jitter_max_.store(std::max(jitter_max_.load(mo), jitter), mo);
+    }
+
+    load_sum_.store(load_sum_.load(mo) + load, mo);
+
+    long bin = std::lround(load * load_bins_per_period);
+    bin = std::max(0L, std::min((long)load_bins - 1, bin));
+    load_histogram_[bin].fetch_add(1, mo);
+
+    last_start_ = start;
+    last_duration_ = duration;
+
+    cycles_.store(cycles + 1, std::memory_order_release);
+}
+
+Audio_Device_Stats Audio_Stats_Collector::snapshot() const
+{
+    const std::memory_order mo = std::memory_order_relaxed;
+    Audio_Device_Stats st;
+
+    st.xruns = xruns_.load(mo);
+    st.cycles = cycles_.load(std::memory_order_acquire);
+    if (st.cycles == 0)
+        return st;
+
+    st.frames_min = frames_min_.load(mo);
+    st.frames_max = frames_max_.load(mo);
+    if (st.cycles > 1) {
+        st.jitter_avg = jitter_sum_.load(mo) / (st.cycles - 1);
+        st.jitter_max = jitter_max_.load(mo);
+    }
+    st.load_min = load_min_.load(mo);
+    st.load_avg = load_sum_.load(mo) / st.cycles;
+    st.load_max = load_max_.load(mo);
+
+    unsigned long total = 0;
+    for (unsigned i = 0; i < load_bins; ++i)
+        total += load_histogram_[i].load(mo);
+
+    // the smallest load which is not exceeded by 99% of the cycles
+    unsigned long above = 0;
+    unsigned bin = load_bins;
+    while (bin > 0 && 100 * (above + load_histogram_[bin - 1].load(mo)) <= total) {
+        above += load_histogram_[bin - 1].load(mo);
+        --bin;
+    }
+    st.load_p99 = std::min((double)bin / load_bins_per_period, st.load_max);
+
+    return st;
+}
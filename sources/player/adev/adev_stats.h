@@ -0,0 +1,57 @@
+//          Copyright Jean Pierre Cimalando 2019-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <chrono>
+#include <atomic>
+
+struct Audio_Device_Stats {
+    // buffer underruns or overruns reported by the audio system
+    unsigned long xruns = 0;
+    unsigned long cycles = 0;
+    // frames per callback
+    unsigned frames_min = 0;
+    unsigned frames_max = 0;
+    // deviation of the callback interval from the duration of the previous block (s)
+    double jitter_avg = 0;
+    double jitter_max = 0;
+    // render time relative to the duration of the block
+    double load_min = 0;
+    double load_avg = 0;
+    double load_p99 = 0;
+    double load_max = 0;
+};
+
+/**
+ * Statistics of the audio callbacks. A single audio thread records the cycles,
+ * and any thread may take a snapshot. The xruns may come from any thread.
+ */
+class Audio_Stats_Collector {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    void record_cycle(clock::time_point start, clock::time_point end, unsigned nframes, double sample_rate);
+    void record_xrun() { xruns_.fetch_add(1, std::memory_order_relaxed); }
+    Audio_Device_Stats snapshot() const;
+
+private:
+    // histogram of the load, for the percentile, in 1/64 period steps up to 2
+    enum { load_bins = 128, load_bins_per_period = 64 };
+
+    std::atomic<unsigned long> xruns_{0};
+    std::atomic<unsigned long> cycles_{0};
+    std::atomic<unsigned> frames_min_{0};
+    std::atomic<unsigned> frames_max_{0};
+    std::atomic<double> jitter_sum_{0};
+    std::atomic<double> jitter_max_{0};
+    std::atomic<double> load_sum_{0};
+    std::atomic<double> load_min_{0};
+    std::atomic<double> load_max_{0};
+    std::atomic<unsigned long> load_histogram_[load_bins] {};
+
+    // only accessed by the audio thread
+    clock::time_point last_start_;
+    double last_duration_ = 0;
+};
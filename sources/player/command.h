@@ -30,7 +30,9 @@ enum {
     PC_Get_Midi_Outputs,
     PC_Set_Midi_Output,
     PC_Set_Synth,
+    PC_Reload_Synth_Options,
     PC_Set_Fx_Parameter,
+    PC_Reconfigure_Audio,
     PC_Shutdown,
 };
 
@@ -130,12 +132,20 @@ struct Pcmd_Set_Synth : Player_Command {
     std::string synth_plugin_id;
 };
 
+struct Pcmd_Reload_Synth_Options : Player_Command {
+    int type() const noexcept override { return PC_Reload_Synth_Options; }
+};
+
 struct Pcmd_Set_Fx_Parameter : Player_Command {
     int type() const noexcept override { return PC_Set_Fx_Parameter; }
     size_t index {};
     int value {};
 };
 
+struct Pcmd_Reconfigure_Audio : Player_Command {
+    int type() const noexcept override { return PC_Reconfigure_Audio; }
+};
+
 struct Pcmd_Shutdown : Player_Command {
     int type() const noexcept override { return PC_Shutdown; }
     std::mutex *wait_mutex = nullptr;
@@ -6,18 +6,31 @@
 #include "player/instruments/synth.h"
 #include "player/smfutil.h"
 #include "synth/synth_host.h"
+#include "synth/synth_utility.h"
 #include "utility/logs.h"
 #include <ring_buffer.h>
+#include <vector>
 #include <algorithm>
 #include <thread>
 #include <mutex>
 #include <atomic>
 #include <chrono>
 #include <cstring>
+#include <cmath>
 
 static constexpr unsigned midi_buffer_size = 8192;
 static constexpr unsigned midi_message_max = 256;
-static constexpr unsigned midi_interval_max = 64;
+static constexpr unsigned midi_event_max = midi_buffer_size / 4;
+
+// limits of the CPU load, relative to the duration of the block
+static constexpr double quality_load_high = 0.75;
+static constexpr double quality_load_low = 0.4;
+// number of successive overloaded blocks before reducing the quality
+static constexpr unsigned quality_overload_blocks = 2;
+// duration under the low limit before raising the quality again
+static constexpr double quality_relax_time = 3.0;
+static constexpr double quality_step = 0.75;
+static constexpr double quality_min = 0.25;
 
 struct Midi_Synth_Instrument::Impl {
     std::unique_ptr<Synth_Host> host_;
@@ -37,17 +50,30 @@ struct Midi_Synth_Instrument::Impl {
     uint8_t next_message_[midi_message_max];
     std::atomic_bool messages_initialized_{false};
 
+    std::vector<synth_event> events_;
+    std::unique_ptr<uint8_t[]> event_data_;
+    unsigned event_data_used_ = 0;
+
     std::mutex host_mutex_;
 
     volatile unsigned cycle_counter_ = 0;
 
+    // reduction of the synth quality under CPU load
+    double quality_ = 1;
+    unsigned quality_overloads_ = 0;
+    double quality_relax_ = 0;
+    std::atomic<unsigned> quality_reductions_{0};
+
     struct AudioConfig {
         double rate = 0;
         double latency = 0;
     };
     AudioConfig config;
 
-    void process_midi(double time_incr);
+    void process_midi(unsigned nframes);
+
+    void govern_quality(double load, double block_time);
+    void reset_quality();
 
     bool extract_next_message();
 
@@ -59,6 +85,8 @@ Midi_Synth_Instrument::Midi_Synth_Instrument()
 {
     impl_->host_.reset(new Synth_Host);
     impl_->midibuf_.reset(new Ring_Buffer(midi_buffer_size));
+    impl_->events_.reserve(midi_event_max);
+    impl_->event_data_.reset(new uint8_t[midi_buffer_size]);
 }
 
 Midi_Synth_Instrument::~Midi_Synth_Instrument()
@@ -102,6 +130,8 @@ void Midi_Synth_Instrument::open_midi_output(nonstd::string_view id)
     if (!host.load(id, impl.config.rate))
         Log::e("Could not open synth: %s", std::string(id).c_str());
 
+    impl.reset_quality();
+
     impl.messages_initialized_.store(false);
     flush_events();
 
@@ -117,6 +147,9 @@ void Midi_Synth_Instrument::close_midi_output()
     std::lock_guard<std::mutex> lock(impl.host_mutex_);
     host.unload();
 
+    if (unsigned count = impl.quality_reductions_.exchange(0))
+        Log::w("Synth quality was reduced %u times due to CPU load", count);
+
     impl.messages_initialized_.store(false);
     flush_events();
 }
@@ -147,11 +180,25 @@ void Midi_Synth_Instrument::configure_audio(double audio_rate, double audio_late
     impl.config.latency = audio_latency;
 }
 
-void Midi_Synth_Instrument::generate_audio(float *output, unsigned nframes)
+double Midi_Synth_Instrument::audio_rate() const
+{
+    const Impl &impl = *impl_;
+    return impl.config.rate;
+}
+
+void Midi_Synth_Instrument::apply_audio_latency()
+{
+    Impl &impl = *impl_;
+
+    // only while the audio is stopped; the synth stays open
+    impl.eff_audio_latency_ = impl.config.latency;
+    impl.messages_initialized_.store(false);
+}
+
+bool Midi_Synth_Instrument::generate_audio(float *output, unsigned nframes, float *const *channels)
 {
     Impl &impl = *impl_;
     Synth_Host &host = *impl.host_;
-    double srate = impl.eff_audio_rate_;
 
     if (!impl.messages_initialized_.exchange(true)) {
         impl.time_delta_ = -impl.eff_audio_latency_;
@@ -162,21 +209,34 @@ void Midi_Synth_Instrument::generate_audio(float *output, unsigned nframes)
         impl.have_next_message_ = false;
     }
 
-    unsigned frame_index = 0;
-    while (frame_index < nframes) {
-        unsigned nframes_current = std::min(nframes - frame_index, midi_interval_max);
-        impl.process_midi(nframes_current * (1.0 / srate));
-        {
-            std::unique_lock<std::mutex> lock(impl.host_mutex_, std::try_to_lock);
-            if (lock.owns_lock())
-                host.generate(&output[2 * frame_index], nframes_current);
-            else
-                std::memset(&output[2 * frame_index], 0, 2 * nframes_current * sizeof(float));
+    impl.events_.clear();
+    impl.event_data_used_ = 0;
+    impl.process_midi(nframes);
+
+    bool audible = false;
+    {
+        std::unique_lock<std::mutex> lock(impl.host_mutex_, std::try_to_lock);
+        if (lock.owns_lock()) {
+            auto start = std::chrono::steady_clock::now();
+            audible = host.process(output, nframes, impl.events_, channels);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            if (host.can_set_quality()) {
+                double block_time = nframes / impl.eff_audio_rate_;
+                impl.govern_quality(elapsed.count() / block_time, block_time);
+            }
+        }
+        else {
+            std::memset(output, 0, 2 * nframes * sizeof(float));
+            for (unsigned i = 0; channels && i < 2 * synth_channel_count; ++i) {
+                if (channels[i])
+                    std::memset(channels[i], 0, nframes * sizeof(float));
+            }
         }
-        frame_index += nframes_current;
     }
 
     impl.cycle_counter_ += 1;
+    return audible;
 }
 
 void Midi_Synth_Instrument::preload(const fmidi_smf_t &smf)
@@ -188,9 +248,28 @@ void Midi_Synth_Instrument::preload(const fmidi_smf_t &smf)
         host.preload(collect_file_instruments(smf));
 }
 
-void Midi_Synth_Instrument::Impl::process_midi(double time_incr)
+int Midi_Synth_Instrument::preload_progress()
 {
-    Synth_Host &host = *host_;
+    Impl &impl = *impl_;
+    Synth_Host &host = *impl.host_;
+
+    // the state is polled often, it must not hold the audio thread back
+    return host.preload_progress();
+}
+
+bool Midi_Synth_Instrument::reload_options()
+{
+    Impl &impl = *impl_;
+    Synth_Host &host = *impl.host_;
+
+    // changes which are live go to the audio thread without locking
+    return host.reload_options();
+}
+
+void Midi_Synth_Instrument::Impl::process_midi(unsigned nframes)
+{
+    const double srate = eff_audio_rate_;
+    const double time_incr = nframes * (1.0 / srate);
 
     time_delta_ += time_incr;
 
@@ -204,18 +283,67 @@ void Midi_Synth_Instrument::Impl::process_midi(double time_incr)
 
         if (time_delta_ < hdr.timestamp)
             break;
+
+        if (events_.size() == midi_event_max || event_data_used_ + hdr.len > midi_buffer_size)
+            break; // batch is full, deliver in next cycle
+
         time_delta_ -= hdr.timestamp;
 
         if (hdr.len > 0) {
-            std::unique_lock<std::mutex> lock(host_mutex_, std::try_to_lock);
-            if (lock.owns_lock())
-                host.send_midi(next_message_, hdr.len);
+            // position of the message relative to the start of the block
+            long frame = std::lround((time_incr - time_delta_) * srate);
+            frame = std::min(frame, (long)nframes - 1);
+            frame = std::max(frame, events_.empty() ? 0L : (long)events_.back().frame);
+
+            uint8_t *data = &event_data_[event_data_used_];
+            std::memcpy(data, next_message_, hdr.len);
+            event_data_used_ += hdr.len;
+
+            events_.push_back(synth_event_decode(data, hdr.len, (unsigned)frame));
         }
 
         have_next_message_ = false;
     }
 }
 
+void Midi_Synth_Instrument::Impl::govern_quality(double load, double block_time)
+{
+    Synth_Host &host = *host_;
+    double quality = quality_;
+
+    if (load > quality_load_high) {
+        quality_relax_ = 0;
+        if (++quality_overloads_ < quality_overload_blocks || quality <= quality_min)
+            return;
+        quality = std::max(quality_min, quality * quality_step);
+        quality_reductions_.fetch_add(1, std::memory_order_relaxed);
+    }
+    else if (load < quality_load_low) {
+        quality_overloads_ = 0;
+        if (quality >= 1 || (quality_relax_ += block_time) < quality_relax_time)
+            return;
+        quality = std::min(1.0, quality / quality_step);
+    }
+    else {
+        // inside the hysteresis band, keep the current setting
+        quality_overloads_ = 0;
+        quality_relax_ = 0;
+        return;
+    }
+
+    quality_ = quality;
+    quality_overloads_ = 0;
+    quality_relax_ = 0;
+    host.set_quality(quality);
+}
+
+void Midi_Synth_Instrument::Impl::reset_quality()
+{
+    quality_ = 1;
+    quality_overloads_ = 0;
+    quality_relax_ = 0;
+}
+
 bool Midi_Synth_Instrument::Impl::extract_next_message()
 {
     if (have_next_message_)
@@ -22,9 +22,13 @@ public:
     bool is_synth() const override { return true; }
 
     void configure_audio(double audio_rate, double audio_latency);
-    void generate_audio(float *output, unsigned nframes);
+    double audio_rate() const;
+    void apply_audio_latency();
+    bool generate_audio(float *output, unsigned nframes, float *const *channels = nullptr);
 
     void preload(const fmidi_smf_t &smf);
+    int preload_progress();
+    bool reload_options();
 
 protected:
     void handle_send_message(const uint8_t *data, unsigned len, double ts, uint8_t flags) override;
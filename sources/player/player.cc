@@ -21,14 +21,26 @@
 #include "utility/charset.h"
 #include "utility/uv++.h"
 #include "utility/logs.h"
+#include "utility/thread_priority.h"
 #include <nonstd/scope.hpp>
 #include <nonstd/string_view.hpp>
 #include <array>
+#include <algorithm>
 #include <stdexcept>
 #include <cstdio>
 #include <cstring>
+#include <cmath>
 #include <cassert>
 
+// automatic latency: range, and the conditions to grow or to shrink the buffer
+static constexpr double auto_latency_min = 10e-3;
+static constexpr double auto_latency_max = 500e-3;
+static constexpr double auto_latency_interval = 2.0;
+static constexpr double auto_latency_xrun_target = 1.0; // per minute
+static constexpr double auto_latency_load_high = 0.7;
+static constexpr double auto_latency_load_low = 0.25;
+static constexpr double auto_latency_stable_time = 60.0;
+
 Player::Player()
     : quit_(false),
       play_list_(new Linear_Play_List),
@@ -68,15 +80,35 @@ Player::Player()
     std::unique_lock<std::mutex> ready_lock(ready_mutex_);
     thread_ = std::thread([this] { thread_exec(); });
     ready_cv_.wait(ready_lock);
+
+    // the device may change its rate or buffer size while running
+    if (adev)
+        adev->set_reconfigure_callback(&audio_reconfigure_callback, this);
 }
 
 Player::~Player()
 {
+    if (Audio_Device *adev = adev_.get())
+        adev->set_reconfigure_callback(nullptr, nullptr);
+
     std::unique_lock<std::mutex> lock(ready_mutex_);
     quit_.store(true);
     uv_async_send(async_);
     ready_cv_.wait(lock);
     thread_.join();
+
+    if (Audio_Device *adev = adev_.get()) {
+        if (unsigned long count = adev->silence_count())
+            Log::w("Audio cycles filled with silence: %lu", count);
+
+        Audio_Device_Stats st = adev->stats();
+        if (st.cycles > 0) {
+            Log::i("Audio cycles: %lu, xruns: %lu, frames: %u-%u", st.cycles, st.xruns, st.frames_min, st.frames_max);
+            Log::i("Audio load: min %.1f%%, avg %.1f%%, p99 %.1f%%, max %.1f%%",
+                   1e2 * st.load_min, 1e2 * st.load_avg, 1e2 * st.load_p99, 1e2 * st.load_max);
+            Log::i("Audio jitter: avg %.2f ms, max %.2f ms", 1e3 * st.jitter_avg, 1e3 * st.jitter_max);
+        }
+    }
 }
 
 void Player::push_command(std::unique_ptr<Player_Command> cmd)
@@ -110,10 +142,19 @@ void Player::thread_exec()
 #endif
     async_ = &async;
 
+    // this thread stays at normal priority: it loads files, parses the
+    //   MIDI and resets the synth, none of which is bounded in time, and the
+    //   audio device buffers the latency which covers its scheduling
+
     Player_Clock clock(loop);
     clock.TimerCallback = [this](uint64_t elapsed) { tick(elapsed); };
     clock_ = &clock;
 
+    Player_Clock latency_clock(loop);
+    latency_clock.TimerCallback = [this](uint64_t) { tune_audio_latency(auto_latency_interval); };
+    if (latency_tuner_.enabled)
+        latency_clock.start((uint64_t)(1e3 * auto_latency_interval));
+
     {
         std::lock_guard<std::mutex> lock(ready_mutex_);
         ready_cv_.notify_one();
@@ -299,7 +340,28 @@ void Player::process_command_queue()
             fx_enable_request_.store(id.empty() ? 0 : 1);
 
             ins->open_midi_output(id);
+            synth_id_ = id;
+
+            // the song in progress did not preload the new synth
+            if (fmidi_smf_t *smf = smf_.get())
+                ins->preload(*smf);
+
+            if (active) start_ticking();
+            break;
+        }
+        case PC_Reload_Synth_Options: {
+            Midi_Synth_Instrument *ins = synth_ins_.get();
+            if (!ins)
+                break;
+
+            if (ins->reload_options())
+                break;
 
+            Log::i("Reload synthesizer: %s", synth_id_.c_str());
+            bool active = stop_ticking();
+            ins->open_midi_output(synth_id_);
+            if (fmidi_smf_t *smf = smf_.get())
+                ins->preload(*smf);
             if (active) start_ticking();
             break;
         }
@@ -309,6 +371,9 @@ void Player::process_command_queue()
             fx_->set_parameter(index, value);
             break;
         }
+        case PC_Reconfigure_Audio:
+            reconfigure_audio();
+            break;
         case PC_Shutdown: {
             std::mutex *wait_mutex = static_cast<Pcmd_Shutdown &>(*cmd).wait_mutex;
             std::condition_variable *wait_cond = static_cast<Pcmd_Shutdown &>(*cmd).wait_cond;
@@ -767,6 +832,13 @@ Player_State Player::make_state() const
     for (size_t p = 0; p < Synth_Fx::Parameter_Count; ++p)
         ps.fx_parameters[p] = fx.get_parameter(p);
 
+    if (synth_ins_)
+        ps.synth_preload_progress = synth_ins_->preload_progress();
+
+    if (adev_)
+        ps.audio_stats = adev_->stats();
+    ps.audio_device_lost = audio_device_lost_.load();
+
     return ps;
 }
 
@@ -815,23 +887,45 @@ Audio_Device *Player::init_audio_device()
 {
     Audio_Device *adev = adev_.get();
 
-    adev = Audio_Device::create_best_for_system();
+    std::unique_ptr<CSimpleIniA> ini = load_global_configuration();
+    if (!ini)
+        ini = create_configuration();
+
+    adev = Audio_Device::create_by_name(ini->GetValue("", "audio-device", "auto"));
     if (!adev) {
         Log::e("Cannot create an audio device for this system");
         return nullptr;
     }
     adev_.reset(adev);
 
-    std::unique_ptr<CSimpleIniA> ini = load_global_configuration();
-    if (!ini)
-        ini = create_configuration();
-
     double desired_sample_rate = ini->GetDoubleValue("", "synth-sample-rate", 44100);
     desired_sample_rate = std::max(22050.0, std::min(192000.0, desired_sample_rate));
 
     double desired_latency = ini->GetDoubleValue("", "synth-audio-latency", 50);
     desired_latency = 1e-3 * std::max(1.0, std::min(500.0, desired_latency));
 
+    Latency_Tuner &lt = latency_tuner_;
+    lt = Latency_Tuner();
+    if (nonstd::string_view(ini->GetValue("", "synth-audio-latency", "")) == "auto") {
+        if (adev->can_set_latency()) {
+            lt.enabled = true;
+            lt.floor = auto_latency_min;
+            desired_latency = auto_latency_min;
+        }
+        else {
+            Log::w("Automatic latency is not possible with this audio system");
+            desired_latency = 50e-3;
+        }
+    }
+
+    int rt_priority = (int)ini->GetLongValue("", "realtime-priority", 70);
+    rt_priority = std::max(0, std::min(99, rt_priority));
+    adev->set_realtime_priority(rt_priority);
+    adev->request_channel_outputs(ini->GetBoolValue("", "synth-channel-outputs", false));
+
+    if (ini->GetBoolValue("", "lock-memory", false) && lock_process_memory())
+        Log::i("Locked the process memory");
+
     if (!adev->init(desired_sample_rate, desired_latency)) {
         Log::e("Cannot initialize the audio device");
         adev_.reset();
@@ -843,10 +937,158 @@ Audio_Device *Player::init_audio_device()
     return adev;
 }
 
-void Player::audio_callback(float *output, unsigned nframes, void *user_data)
+void Player::reconfigure_audio()
+{
+    Audio_Device *adev = adev_.get();
+    Midi_Synth_Instrument *ins = synth_ins_.get();
+    if (!adev || !ins)
+        return;
+
+    const double audio_rate = adev->sample_rate();
+    const double audio_latency = adev->latency();
+    const bool rate_changed = audio_rate != ins->audio_rate();
+    Log::i("Reconfigure audio: %f Hz, %f ms", audio_rate, 1e3 * audio_latency);
+
+    bool active = stop_ticking();
+
+    // detach the processing while the parts which depend on it are reset
+    adev->set_callback(nullptr, nullptr);
+    ins->configure_audio(audio_rate, audio_latency);
+    if (rate_changed) {
+        analyzer_10band &an = level_analyzer_;
+        an.init(audio_rate);
+        an.setup(1.0, 16e3, 100e-3);
+        fx_->init(audio_rate);
+        current_volume_.setSampleRate(audio_rate);
+        current_volume_.clearToTarget();
+    }
+    else
+        ins->apply_audio_latency();
+    adev->set_callback(&audio_callback, this);
+
+    // the synth renders at the rate it was opened with, open it again
+    if (rate_changed && !synth_id_.empty()) {
+        ins->open_midi_output(synth_id_);
+        if (fmidi_smf_t *smf = smf_.get())
+            ins->preload(*smf);
+    }
+
+    if (active) start_ticking();
+}
+
+void Player::tune_audio_latency(double interval)
+{
+    Audio_Device *adev = adev_.get();
+    Latency_Tuner &lt = latency_tuner_;
+    if (!adev || !lt.enabled)
+        return;
+
+    const Audio_Device_Stats st = adev->stats();
+    const unsigned long cycles = st.cycles - lt.last_cycles;
+    const unsigned long xruns = st.xruns - lt.last_xruns;
+    const double load_sum = st.load_avg * st.cycles;
+    const double load = cycles ? ((load_sum - lt.last_load_sum) / cycles) : 0.0;
+    lt.last_cycles = st.cycles;
+    lt.last_xruns = st.xruns;
+    lt.last_load_sum = load_sum;
+
+    if (cycles == 0)
+        return;
+
+    // xruns per minute, averaged over about a minute
+    const double decay = std::exp(-interval / 60.0);
+    lt.xrun_rate = lt.xrun_rate * decay + xruns * (1 - decay) * (60.0 / interval);
+
+    const double latency = adev->latency();
+
+    if (lt.xrun_rate > auto_latency_xrun_target || load > auto_latency_load_high) {
+        if (latency >= auto_latency_max)
+            return;
+        // do not come back to a latency which was found too small
+        if (xruns > 0)
+            lt.floor = std::max(lt.floor, 2 * latency);
+        Log::i("Audio latency too small: %.1f xruns/min, load %.0f%%", lt.xrun_rate, 1e2 * load);
+        change_audio_latency(std::min(auto_latency_max, 2 * latency));
+        lt.stable_time = 0;
+        lt.xrun_rate = 0;
+    }
+    else if (load < auto_latency_load_low && lt.xrun_rate == 0) {
+        lt.stable_time += interval;
+        if (lt.stable_time >= auto_latency_stable_time && latency / 2 >= lt.floor) {
+            change_audio_latency(latency / 2);
+            lt.stable_time = 0;
+        }
+    }
+    else
+        lt.stable_time = 0;
+}
+
+bool Player::change_audio_latency(double latency)
+{
+    Audio_Device *adev = adev_.get();
+    Midi_Synth_Instrument *ins = synth_ins_.get();
+    if (!adev || !ins)
+        return false;
+
+    const double old_rate = adev->sample_rate();
+    const double old_latency = adev->latency();
+
+    bool active = stop_ticking();
+
+    adev->shutdown();
+    bool success = adev->init(old_rate, latency);
+    if (!success) {
+        Log::e("Cannot reopen the audio device with a latency of %f ms", 1e3 * latency);
+        if (!adev->init(old_rate, old_latency)) {
+            // the playback goes on without sound, and the tuning stops
+            Log::e("Cannot reopen the audio device");
+            latency_tuner_.enabled = false;
+            audio_device_lost_.store(true);
+            if (active) start_ticking();
+            return false;
+        }
+    }
+
+    const double audio_rate = adev->sample_rate();
+    const double audio_latency = adev->latency();
+    Log::i("Audio latency: %f ms", 1e3 * audio_latency);
+
+    if (audio_rate == old_rate) {
+        ins->configure_audio(audio_rate, audio_latency);
+        ins->apply_audio_latency();
+        adev->start();
+    }
+    else {
+        adev->start();
+        reconfigure_audio();
+    }
+
+    if (active) start_ticking();
+    return success;
+}
+
+static bool is_silent(const float *output, unsigned nframes)
+{
+    const float threshold = 1e-5f;
+    for (unsigned i = 0; i < 2 * nframes; ++i) {
+        if (std::fabs(output[i]) > threshold)
+            return false;
+    }
+    return true;
+}
+
+void Player::audio_reconfigure_callback(void *user_data)
 {
     Player *self = reinterpret_cast<Player *>(user_data);
-    self->synth_ins_->generate_audio(output, nframes);
+    std::unique_ptr<Pcmd_Reconfigure_Audio> cmd(new Pcmd_Reconfigure_Audio);
+    self->push_command(std::move(cmd));
+}
+
+void Player::audio_callback(float *output, float *const *channels, unsigned nframes, void *user_data)
+{
+    Player *self = reinterpret_cast<Player *>(user_data);
+    // the separate channels are dry, the effects and the volume are on the mix
+    bool audible = self->synth_ins_->generate_audio(output, nframes, channels);
 
     ///
     Synth_Fx &fx = *self->fx_;
@@ -860,14 +1102,28 @@ void Player::audio_callback(float *output, unsigned nframes, void *user_data)
         if (fx_enabled)
             fx.clear();
         self->fx_enabled_ = fx_enabled;
+        self->fx_idle_ = false;
+    }
+    if (fx_enabled) {
+        // let the effect tail decay, then bypass until the synth sounds again
+        if (audible)
+            self->fx_idle_ = false;
+        if (!self->fx_idle_) {
+            fx.compute(output, nframes);
+            if (!audible && is_silent(output, nframes)) {
+                fx.clear();
+                self->fx_idle_ = true;
+            }
+        }
+        audible = audible || !self->fx_idle_;
     }
-    if (fx_enabled)
-        fx.compute(output, nframes);
 
     ///
     ExpSmoother &smooth_volume = self->current_volume_;
     float final_volume = smooth_volume.getTarget();
-    if (smooth_volume.getCurrentValue() == final_volume) {
+    if (!audible)
+        smooth_volume.clearToTarget();
+    else if (smooth_volume.getCurrentValue() == final_volume) {
         if (final_volume != 1) {
             for (unsigned i = 0; i < 2 * nframes; ++i)
                 output[i] *= final_volume;
@@ -885,8 +1141,24 @@ void Player::audio_callback(float *output, unsigned nframes, void *user_data)
     }
 
     ///
+    if (audible)
+        self->levels_idle_ = false;
+    if (self->levels_idle_)
+        return;
+
     const float *levels = self->level_analyzer_.compute_stereo(output, nframes);
+    bool levels_idle = !audible &&
+        std::all_of(levels, levels + 10, [](float l) { return l < 1e-6f; });
+    if (levels_idle) {
+        self->level_analyzer_.clear();
+        self->levels_idle_ = true;
+    }
+
     std::unique_lock<std::mutex> levels_lock(self->current_levels_mutex_, std::try_to_lock);
-    if (levels_lock.owns_lock())
-        std::memcpy(self->current_levels_, levels, 10 * sizeof(float));
+    if (levels_lock.owns_lock()) {
+        if (levels_idle)
+            std::fill(self->current_levels_, self->current_levels_ + 10, 0.0f);
+        else
+            std::memcpy(self->current_levels_, levels, 10 * sizeof(float));
+    }
 }
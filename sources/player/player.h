@@ -14,6 +14,7 @@
 #include <condition_variable>
 #include <atomic>
 #include <vector>
+#include <string>
 #include <queue>
 #include <functional>
 struct Player_Command;
@@ -74,7 +75,11 @@ private:
     Playing_Status get_current_status() const;
 
     Audio_Device *init_audio_device();
-    static void audio_callback(float *output, unsigned nframes, void *user_data);
+    static void audio_callback(float *output, float *const *channels, unsigned nframes, void *user_data);
+    static void audio_reconfigure_callback(void *user_data);
+    void reconfigure_audio();
+    void tune_audio_latency(double interval);
+    bool change_audio_latency(double latency);
 
 private:
     std::thread thread_;
@@ -107,6 +112,7 @@ private:
     // instrument
     std::unique_ptr<Midi_Port_Instrument> midiport_ins_;
     std::unique_ptr<Midi_Synth_Instrument> synth_ins_;
+    std::string synth_id_;
 
     // timestamping
     bool ts_started_ = false;
@@ -117,10 +123,25 @@ private:
     float current_levels_[10] {};
     std::mutex current_levels_mutex_;
     bool fx_enabled_ = false;
+    bool fx_idle_ = false;
+    bool levels_idle_ = false;
     std::atomic<int> fx_enable_request_ {};
     std::unique_ptr<Synth_Fx> fx_;
     std::unique_ptr<Audio_Device> adev_;
 
+    // automatic latency
+    struct Latency_Tuner {
+        bool enabled = false;
+        double floor = 0;
+        double stable_time = 0;
+        double xrun_rate = 0;
+        unsigned long last_cycles = 0;
+        unsigned long last_xruns = 0;
+        double last_load_sum = 0;
+    };
+    Latency_Tuner latency_tuner_;
+    std::atomic_bool audio_device_lost_ {false};
+
     // startup and shutdown synchronization
     std::condition_variable ready_cv_;
     std::mutex ready_mutex_;
@@ -6,6 +6,7 @@
 #pragma once
 #include "keystate.h"
 #include "instruments/synth_fx.h"
+#include "adev/adev_stats.h"
 #include <string>
 #include <vector>
 #include <bitset>
@@ -41,4 +42,7 @@ struct Player_State {
     std::bitset<16> channel_enabled;
     float audio_levels[10] {};
     int fx_parameters[Synth_Fx::Parameter_Count] {};
+    int synth_preload_progress = -1;
+    Audio_Device_Stats audio_stats;
+    bool audio_device_lost = false;
 };
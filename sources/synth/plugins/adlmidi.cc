@@ -4,13 +4,18 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #include "../synth.h"
+#include "../synth_utility.h"
 #include "utility/paths.h"
 #include "utility/logs.h"
 #include <adlmidi.h>
 #include <algorithm>
+#include <vector>
 #include <memory>
 #include <cstring>
+#include <cstdlib>
+#include <chrono>
 #include <cctype>
+#include <cstdio>
 
 ///
 struct ADL_MIDIPlayer_delete { void operator()(ADL_MIDIPlayer *x) const { adl_close(x); } };
@@ -19,17 +24,35 @@ typedef std::unique_ptr<ADL_MIDIPlayer, ADL_MIDIPlayer_delete> ADL_MIDIPlayer_u;
 ///
 struct adlmidi_synth_object {
     double srate = 0;
-    ADL_MIDIPlayer_u player;
+    std::vector<ADL_MIDIPlayer_u> players;
+    std::unique_ptr<float[]> mix_buffer;
+    synth_activity_monitor activity;
+    // the channel states of a player, as the library describes them
+    std::vector<char> channel_text;
+    std::vector<char> channel_attr;
 
     int chip_count = 0;
     std::string instrument_bank;
     std::string emulator;
     std::string volume_model;
     bool automatic_arpeggio = true;
+    int parallel_players = 1;
+    double cpu_budget = 0;
 };
 
+// limits of the rendering of players in parallel
+static constexpr unsigned adlmidi_max_players = 8;
+static constexpr unsigned adlmidi_mix_frames = 256;
+// OPL3 channels of a chip, including the rhythm ones
+static constexpr unsigned adlmidi_chip_channels = 23;
+
 static std::string adlmidi_synth_base_dir;
 
+static const synth_host_interface *adlmidi_plugin_host;
+
+// external banks, which stay mapped across activations
+static synth_file_cache adlmidi_bank_files;
+
 static void adlmidi_plugin_init(const char *base_dir)
 {
     adlmidi_synth_base_dir.assign(base_dir);
@@ -37,14 +60,23 @@ static void adlmidi_plugin_init(const char *base_dir)
 
 static void adlmidi_plugin_shutdown()
 {
+    adlmidi_bank_files.clear(adlmidi_plugin_host);
+    adlmidi_plugin_host = nullptr;
+}
+
+static void adlmidi_plugin_set_host(const synth_host_interface *host)
+{
+    adlmidi_plugin_host = host;
 }
 
 static const synth_option the_synth_options[] = {
     {"chip-count", "Number of emulated chips", 'i', {.i = 4}},
     {"instrument-bank", "Bank number, or WOPL file path", 's', {.s = "0"}},
-    {"emulator", "Name of the chip emulator", 's', {.s = "dosbox"}},
+    {"emulator", "Name of the chip emulator, or \"auto\" to choose by the CPU cost", 's', {.s = "dosbox"}},
     {"volume-model", "Name of the volume model", 's', {.s = "auto"}},
-    {"automatic-arpeggio", "Enable the automatic arpeggio system", 'b', {.b = true}},
+    {"automatic-arpeggio", "Enable the automatic arpeggio system", 'b', {.b = true}, SYNTH_OPTION_LIVE},
+    {"parallel-players", "Number of players which share the chips and the channels, rendered in parallel [1:8]", 'i', {.i = 1}},
+    {"cpu-budget", "Fraction of a CPU core for the chips of a player, if the emulator is automatic", 'f', {.f = 0.25}},
 };
 
 struct named_emulator {
@@ -60,6 +92,9 @@ static const named_emulator the_emulators[] = {
     {"java", ADLMIDI_EMU_JAVA},
 };
 
+// emulators by decreasing accuracy, for the automatic choice
+static const char *const the_accurate_emulators[] = {"nuked", "nuked 1.7", "java", "dosbox", "opal"};
+
 struct named_volume_model {
     const char *name;
     int value;
@@ -104,14 +139,12 @@ static void adlmidi_synth_cleanup(synth_object *obj)
     delete sy;
 }
 
-static int adlmidi_synth_activate(synth_object *obj)
+static ADL_MIDIPlayer *adlmidi_create_player(adlmidi_synth_object *sy, const std::string &emulator_name, int chip_count)
 {
-    adlmidi_synth_object *sy = (adlmidi_synth_object *)obj;
-
-    ADL_MIDIPlayer *player = adl_init(sy->srate);
+    ADL_MIDIPlayer_u player_u(adl_init(sy->srate));
+    ADL_MIDIPlayer *player = player_u.get();
     if (!player)
-        return -1;
-    sy->player.reset(player);
+        return nullptr;
 
     auto str_to_lower = [](std::string text) -> std::string {
         std::transform(text.begin(), text.end(), text.begin(),
@@ -123,13 +156,13 @@ static int adlmidi_synth_activate(synth_object *obj)
     int emulator = -1;
     const unsigned num_emulators = sizeof(the_emulators) / sizeof(the_emulators[0]);
 
-    const std::string emu_id = str_to_lower(sy->emulator);
+    const std::string emu_id = str_to_lower(emulator_name);
     for (unsigned i = 0; i < num_emulators && emulator == -1; ++i) {
         if (emu_id == the_emulators[i].name)
             emulator = the_emulators[i].value;
     }
     if (emulator == -1) {
-        Log::e("adlmidi: cannot find an emulator named \"%s\"", sy->emulator.c_str());
+        Log::e("adlmidi: cannot find an emulator named \"%s\"", emulator_name.c_str());
         emulator = the_emulators[0].value;
     }
 
@@ -153,8 +186,8 @@ static int adlmidi_synth_activate(synth_object *obj)
 
     adl_setVolumeRangeModel(player, volume_model);
 
-    if (adl_setNumChips(player, sy->chip_count) != 0)
-        Log::e("adlmidi: cannot set chip count %d", sy->chip_count);
+    if (adl_setNumChips(player, chip_count) != 0)
+        Log::e("adlmidi: cannot set chip count %d", chip_count);
 
     Log::i("adlmidi: use %d chips \"%s\"", adl_getNumChips(player), adl_chipEmulatorName(player));
 
@@ -170,86 +203,226 @@ static int adlmidi_synth_activate(synth_object *obj)
         if (!is_path_absolute(path))
             path = adlmidi_synth_base_dir + path;
         Log::i("adlmidi: set bank file %s", path.c_str());
-        if (adl_openBankFile(player, path.c_str()) != 0)
+        size_t size = 0;
+        const void *data = adlmidi_bank_files.map(adlmidi_plugin_host, path, &size);
+        int result = data ? adl_openBankData(player, data, (unsigned long)size) : adl_openBankFile(player, path.c_str());
+        if (result != 0)
             Log::e("adlmidi: cannot set bank file \"%s\"", path.c_str());
     }
 
     adl_setAutoArpeggio(player, sy->automatic_arpeggio);
 
-    return 0;
+    return player_u.release();
 }
 
-static void adlmidi_synth_deactivate(synth_object *obj)
+static int adlmidi_player_chips(int chip_count, unsigned player_count, unsigned index)
+{
+    // distribute the chips evenly, with at least one per player
+    int chips = chip_count / (int)player_count + ((int)index < chip_count % (int)player_count);
+    return (chips > 1) ? chips : 1;
+}
+
+static void adlmidi_render(ADL_MIDIPlayer *player, float *frames, size_t nframes);
+
+static double adlmidi_measure_emulator(double srate, int emulator)
+{
+    // time to render one second with a chip, having all its voices in use
+    ADL_MIDIPlayer_u player(adl_init((long)srate));
+    if (!player || adl_switchEmulator(player.get(), emulator) != 0 || adl_setNumChips(player.get(), 1) != 0)
+        return -1;
+
+    for (unsigned channel = 0; channel < 16; ++channel) {
+        if (channel == 9)
+            continue;
+        adl_rt_patchChange(player.get(), channel, 8 * channel);
+        for (unsigned note = 48; note < 72; note += 7)
+            adl_rt_noteOn(player.get(), channel, note, 100);
+    }
+
+    // a quarter of a second is enough, and the audio waits during this
+    constexpr size_t block_frames = 256;
+    float block[2 * block_frames];
+    const size_t block_count = (size_t)srate / (4 * block_frames);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < block_count; ++i)
+        adlmidi_render(player.get(), block, block_frames);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return elapsed.count() * srate / (double)(block_count * block_frames);
+}
+
+static std::string adlmidi_choose_emulator(adlmidi_synth_object *sy, int chip_count)
+{
+    const unsigned num_emulators = sizeof(the_emulators) / sizeof(the_emulators[0]);
+    const unsigned num_candidates = sizeof(the_accurate_emulators) / sizeof(the_accurate_emulators[0]);
+
+    const char *cheapest = the_accurate_emulators[num_candidates - 1];
+    double cheapest_cost = -1;
+
+    for (unsigned c = 0; c < num_candidates; ++c) {
+        const char *name = the_accurate_emulators[c];
+        int emulator = -1;
+        for (unsigned i = 0; i < num_emulators && emulator == -1; ++i) {
+            if (!strcmp(name, the_emulators[i].name))
+                emulator = the_emulators[i].value;
+        }
+
+        // measured on first use, and kept for the next runs
+        char key[64];
+        sprintf(key, "%s@%ld", name, (long)sy->srate);
+        double cost = -1;
+        std::string cached;
+        if (synth_cache_get(adlmidi_plugin_host, "adlmidi", key, cached))
+            cost = std::atof(cached.c_str());
+        else {
+            Log::i("adlmidi: measure the cost of emulator \"%s\"", name);
+            cost = adlmidi_measure_emulator(sy->srate, emulator);
+            if (cost > 0)
+                synth_cache_set(adlmidi_plugin_host, "adlmidi", key, std::to_string(cost).c_str());
+        }
+
+        if (cost <= 0)
+            continue;
+
+        Log::i("adlmidi: emulator \"%s\" uses %.1f%% CPU with %d chips", name, 100 * cost * chip_count, chip_count);
+        if (cost * chip_count <= sy->cpu_budget)
+            return name;
+
+        if (cheapest_cost < 0 || cost < cheapest_cost) {
+            cheapest = name;
+            cheapest_cost = cost;
+        }
+    }
+
+    Log::w("adlmidi: no emulator fits the CPU budget, use the least costly");
+    return cheapest;
+}
+
+static int adlmidi_synth_activate(synth_object *obj)
 {
     adlmidi_synth_object *sy = (adlmidi_synth_object *)obj;
-    sy->player.reset();
+
+    unsigned count = (unsigned)std::max(1, std::min(sy->parallel_players, sy->chip_count));
+    count = std::min(count, adlmidi_max_players);
+
+    // the players run in parallel, the budget applies to the largest
+    std::string emulator = sy->emulator;
+    if (emulator == "auto") {
+        emulator = adlmidi_choose_emulator(sy, adlmidi_player_chips(sy->chip_count, count, 0));
+        Log::i("adlmidi: choose emulator \"%s\"", emulator.c_str());
+    }
+
+    for (unsigned i = 0; i < count; ++i) {
+        ADL_MIDIPlayer *player = adlmidi_create_player(sy, emulator, adlmidi_player_chips(sy->chip_count, count, i));
+        if (!player) {
+            sy->players.clear();
+            return -1;
+        }
+        sy->players.emplace_back(player);
+    }
+
+    if (count > 1) {
+        Log::i("adlmidi: render %u players in parallel", count);
+        sy->mix_buffer.reset(new float[2 * adlmidi_mix_frames * (count - 1)]);
+    }
+
+    size_t channel_count = adlmidi_chip_channels * adlmidi_player_chips(sy->chip_count, count, 0);
+    sy->channel_text.assign(channel_count + 1, 0);
+    sy->channel_attr.assign(channel_count + 1, 0);
+
+    sy->activity.init(sy->srate);
+
+    return 0;
 }
 
-static void adlmidi_synth_write(synth_object *obj, const unsigned char *msg, size_t size)
+static void adlmidi_synth_deactivate(synth_object *obj)
 {
     adlmidi_synth_object *sy = (adlmidi_synth_object *)obj;
-    ADL_MIDIPlayer *player = sy->player.get();
+    sy->players.clear();
+    sy->mix_buffer.reset();
+}
 
-    if (size <= 0)
+static void adlmidi_synth_dispatch(ADL_MIDIPlayer *player, const synth_event &ev)
+{
+    if (ev.size <= 0)
         return;
 
-    unsigned status = msg[0];
+    unsigned status = ev.status;
     if (status == 0xf0) {
-        adl_rt_systemExclusive(player, msg, size);
+        adl_rt_systemExclusive(player, ev.data, ev.size);
         return;
     }
 
     unsigned channel = status & 0x0f;
     switch (status >> 4) {
     case 0b1001: {
-        if (size < 3) break;
-        unsigned vel = msg[2] & 0x7f;
+        if (ev.size < 3) break;
+        unsigned vel = ev.data2;
         if (vel != 0) {
-            unsigned note = msg[1] & 0x7f;
+            unsigned note = ev.data1;
             adl_rt_noteOn(player, channel, note, vel);
             break;
         }
     }
     case 0b1000: {
-        if (size < 3) break;
-        unsigned note = msg[1] & 0x7f;
+        if (ev.size < 3) break;
+        unsigned note = ev.data1;
         adl_rt_noteOff(player, channel, note);
         break;
     }
     case 0b1010:
-        if (size < 3) break;
-        adl_rt_noteAfterTouch(player, channel, msg[1] & 0x7f, msg[2] & 0x7f);
+        if (ev.size < 3) break;
+        adl_rt_noteAfterTouch(player, channel, ev.data1, ev.data2);
         break;
     case 0b1101:
-        if (size < 2) break;
-        adl_rt_channelAfterTouch(player, channel, msg[1] & 0x7f);
+        if (ev.size < 2) break;
+        adl_rt_channelAfterTouch(player, channel, ev.data1);
         break;
     case 0b1011: {
-        if (size < 3) break;
-        unsigned cc = msg[1] & 0x7f;
-        unsigned val = msg[2] & 0x7f;
+        if (ev.size < 3) break;
+        unsigned cc = ev.data1;
+        unsigned val = ev.data2;
         adl_rt_controllerChange(player, channel, cc, val);
         break;
     }
     case 0b1100: {
-        if (size < 2) break;
-        unsigned pgm = msg[1] & 0x7f;
+        if (ev.size < 2) break;
+        unsigned pgm = ev.data1;
         adl_rt_patchChange(player, channel, pgm);
         break;
     }
     case 0b1110:
-        if (size < 3) break;
-        unsigned value = (msg[1] & 0x7f) | ((msg[2] & 0x7f) << 7);
+        if (ev.size < 3) break;
+        unsigned value = ev.data1 | (ev.data2 << 7);
         adl_rt_pitchBend(player, channel, value);
         break;
     }
 }
 
-static void adlmidi_synth_generate(synth_object *obj, float *frames, size_t nframes)
+static void adlmidi_synth_route(adlmidi_synth_object *sy, const synth_event &ev)
+{
+    size_t count = sy->players.size();
+
+    // channel messages go to the player of the channel, others to all
+    if (ev.status >= 0x80 && ev.status < 0xf0)
+        adlmidi_synth_dispatch(sy->players[(ev.status & 0x0f) % count].get(), ev);
+    else {
+        for (size_t i = 0; i < count; ++i)
+            adlmidi_synth_dispatch(sy->players[i].get(), ev);
+    }
+}
+
+static void adlmidi_synth_write(synth_object *obj, const unsigned char *msg, size_t size)
 {
     adlmidi_synth_object *sy = (adlmidi_synth_object *)obj;
-    ADL_MIDIPlayer *player = sy->player.get();
 
+    adlmidi_synth_route(sy, synth_event_decode(msg, size));
+    sy->activity.trigger();
+}
+
+static void adlmidi_render(ADL_MIDIPlayer *player, float *frames, size_t nframes)
+{
     ADLMIDI_AudioFormat format;
     format.type = ADLMIDI_SampleType_F32;
     format.containerSize = sizeof(float);
@@ -257,10 +430,109 @@ static void adlmidi_synth_generate(synth_object *obj, float *frames, size_t nfra
     adl_generateFormat(player, 2 * nframes, (ADL_UInt8 *)frames, (ADL_UInt8 *)(frames + 1), &format);
 }
 
+struct adlmidi_render_job {
+    ADL_MIDIPlayer *player;
+    float *frames;
+    size_t nframes;
+};
+
+static void adlmidi_render_all(adlmidi_synth_object *sy, float *frames, size_t nframes)
+{
+    size_t count = sy->players.size();
+
+    if (count == 1) {
+        adlmidi_render(sy->players[0].get(), frames, nframes);
+        return;
+    }
+
+    // the first player renders to the output, the others get mixed into it
+    adlmidi_render_job data[adlmidi_max_players];
+    synth_job jobs[adlmidi_max_players];
+    float *mix = sy->mix_buffer.get();
+
+    while (nframes > 0) {
+        size_t segment = std::min<size_t>(nframes, adlmidi_mix_frames);
+
+        for (size_t i = 0; i < count; ++i) {
+            data[i].player = sy->players[i].get();
+            data[i].frames = (i == 0) ? frames : (mix + 2 * adlmidi_mix_frames * (i - 1));
+            data[i].nframes = segment;
+            jobs[i].data = &data[i];
+            jobs[i].function = [](void *user_data) {
+                adlmidi_render_job *job = (adlmidi_render_job *)user_data;
+                adlmidi_render(job->player, job->frames, job->nframes);
+            };
+        }
+
+        synth_run_jobs(adlmidi_plugin_host, jobs, count);
+
+        for (size_t i = 1; i < count; ++i)
+            synth_mix_add(frames, data[i].frames, 2 * segment);
+
+        frames += 2 * segment;
+        nframes -= segment;
+    }
+}
+
+static void adlmidi_synth_generate(synth_object *obj, float *frames, size_t nframes)
+{
+    adlmidi_synth_object *sy = (adlmidi_synth_object *)obj;
+
+    adlmidi_render_all(sy, frames, nframes);
+    sy->activity.analyze(frames, nframes);
+}
+
+static void adlmidi_synth_process(synth_object *obj, float *frames, size_t nframes, const synth_event *events, size_t nevents)
+{
+    adlmidi_synth_object *sy = (adlmidi_synth_object *)obj;
+
+    synth_process_in_segments(
+        frames, nframes, events, nevents,
+        [sy](float *frames, size_t count) { adlmidi_render_all(sy, frames, count); },
+        [sy](const synth_event &ev) { adlmidi_synth_route(sy, ev); });
+
+    if (nevents > 0)
+        sy->activity.trigger();
+    sy->activity.analyze(frames, nframes);
+}
+
+static int adlmidi_sounding_channels(ADL_MIDIPlayer *player, char *text, char *attr, size_t size)
+{
+    // the chip channels which hold a note, where anything but '-' denotes a
+    //   user: keyed on, sustained by either pedal, or shared by arpeggio
+    int count = 0;
+    if (adl_describeChannels(player, text, attr, size) == 0) {
+        for (size_t i = 0; i < size && text[i]; ++i)
+            count += text[i] != '-';
+    }
+    return count;
+}
+
+static int adlmidi_synth_active_voices(synth_object *obj)
+{
+    adlmidi_synth_object *sy = (adlmidi_synth_object *)obj;
+    char *text = sy->channel_text.data();
+    char *attr = sy->channel_attr.data();
+    size_t size = sy->channel_text.size();
+
+    int count = 0;
+    for (const ADL_MIDIPlayer_u &player : sy->players)
+        count += adlmidi_sounding_channels(player.get(), text, attr, size);
+
+    // notes which are released still sound until the envelope ends, which
+    //   the library does not tell, so watch the output then
+    if (count == 0 && sy->activity.active())
+        count = 1;
+
+    return count;
+}
+
 static void adlmidi_synth_set_option(synth_object *obj, const char *name, synth_value value)
 {
     adlmidi_synth_object *sy = (adlmidi_synth_object *)obj;
 
+    unsigned count = (unsigned)sy->players.size();
+
     if (!strcmp(name, "chip-count"))
         sy->chip_count = value.i;
     else if (!strcmp(name, "instrument-bank"))
@@ -269,8 +541,21 @@ static void adlmidi_synth_set_option(synth_object *obj, const char *name, synth_
         sy->emulator.assign(value.s);
     else if (!strcmp(name, "volume-model"))
         sy->volume_model.assign(value.s);
-    else if (!strcmp(name, "automatic-arpeggio"))
+    else if (!strcmp(name, "automatic-arpeggio")) {
         sy->automatic_arpeggio = value.b;
+        for (unsigned i = 0; i < count; ++i)
+            adl_setAutoArpeggio(sy->players[i].get(), sy->automatic_arpeggio);
+    }
+    else if (!strcmp(name, "parallel-players"))
+        sy->parallel_players = (int)std::max(1L, std::min((long)adlmidi_max_players, value.i));
+    else if (!strcmp(name, "cpu-budget"))
+        sy->cpu_budget = value.f;
+}
+
+// the OPL3 runs at its clock rate of 14.31818 MHz divided by 288
+static double adlmidi_plugin_preferred_rate()
+{
+    return 49716;
 }
 
 static const synth_interface the_synth_interface = {
@@ -287,6 +572,14 @@ static const synth_interface the_synth_interface = {
     &adlmidi_synth_generate,
     &adlmidi_synth_set_option,
     nullptr,
+    &adlmidi_synth_process,
+    &adlmidi_plugin_set_host,
+    &adlmidi_synth_active_voices,
+    nullptr,
+    nullptr,
+    &adlmidi_plugin_preferred_rate,
+    nullptr,
+    nullptr,
 };
 
 extern "C" SYNTH_EXPORT const synth_interface *synth_plugin_entry()
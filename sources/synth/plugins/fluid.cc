@@ -9,9 +9,14 @@
 #include "utility/paths.h"
 #include "utility/logs.h"
 #include <fluidlite.h>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
 #include <memory>
+#include <mutex>
 #include <cstdlib>
 #include <cstring>
+#include <cmath>
 
 ///
 struct fluid_synth_delete { void operator()(fluid_synth_t *x) const noexcept { delete_fluid_synth(x); } };
@@ -21,10 +26,24 @@ typedef std::unique_ptr<fluid_synth_t, fluid_synth_delete> fluid_synth_u;
 typedef std::unique_ptr<fluid_settings_t, fluid_settings_delete> fluid_settings_u;
 ///
 
+struct fluid_soundfont {
+    std::string path;
+    // presets as (bank << 7) | program, or empty if unknown
+    std::vector<unsigned> presets;
+    int sfid = -1;
+};
+
 struct fluid_synth_object {
+    double srate = 0;
+    synth_activity_monitor activity;
     string_list_ptr soundfonts;
     fluid_settings_u settings;
     fluid_synth_u synth;
+    int polyphony = 0;
+    double quality = 1;
+
+    bool lazy_loading = false;
+    std::vector<fluid_soundfont> fonts;
 
     bool chorus_enable = false;
     int chorus_voices = 0;
@@ -38,8 +57,17 @@ struct fluid_synth_object {
     double reverb_damping = 0;
     double reverb_width = 0;
     double reverb_level = 0;
+
+    int interpolation = 0;
+
+    // MIDI channels rendered to groups of their own
+    bool channel_outputs = false;
+    std::unique_ptr<float[]> channel_scratch;
 };
 
+// the channel groups, then the reverb and chorus
+enum { fluid_channel_count = 16, fluid_fx_count = 2, fluid_channel_block = 256 };
+
 static std::string fluid_synth_base_dir;
 
 ///
@@ -62,6 +90,43 @@ static void fluid_log_info(int, const char *message, void *)
 ///
 
 static fluid_fileapi_t fluid_plugin_fileapi;
+static int (*fluid_default_fclose)(void *);
+
+static const synth_host_interface *fluid_plugin_host;
+
+// soundfont files which are read from a mapping of the host
+static std::unordered_map<void *, const void *> fluid_mapped_files;
+static std::mutex fluid_mapped_files_mutex;
+
+static FILE *fluid_plugin_fopen_mapped(const char *path)
+{
+#if !defined(_WIN32)
+    const synth_host_interface *host = fluid_plugin_host;
+    if (!host || !host->map_file)
+        return nullptr;
+
+    size_t size = 0;
+    const void *data = host->map_file(host->context, path, &size);
+    if (!data)
+        return nullptr;
+
+    FILE *fh = fmemopen((void *)data, size, "rb");
+    if (!fh) {
+        host->unmap_file(host->context, data);
+        return nullptr;
+    }
+
+    // the whole sample data gets read by the soundfont loader
+    host->prefetch_file(host->context, data, size);
+
+    std::lock_guard<std::mutex> lock(fluid_mapped_files_mutex);
+    fluid_mapped_files[fh] = data;
+    return fh;
+#else
+    (void)path;
+    return nullptr;
+#endif
+}
 
 static void fluid_plugin_init(const char *base_dir)
 {
@@ -76,8 +141,27 @@ static void fluid_plugin_init(const char *base_dir)
     fluid_init_default_fileapi(&fluid_plugin_fileapi);
     fluid_plugin_fileapi.fopen = [](fluid_fileapi_t *fileapi, const char *path) -> void *
     {
+        if (FILE *fh = fluid_plugin_fopen_mapped(path))
+            return fh;
         return fopen_utf8(path, "rb");
     };
+    fluid_default_fclose = fluid_plugin_fileapi.fclose;
+    fluid_plugin_fileapi.fclose = [](void *handle) -> int
+    {
+        const void *data = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(fluid_mapped_files_mutex);
+            auto it = fluid_mapped_files.find(handle);
+            if (it != fluid_mapped_files.end()) {
+                data = it->second;
+                fluid_mapped_files.erase(it);
+            }
+        }
+        int ret = fluid_default_fclose(handle);
+        if (data)
+            fluid_plugin_host->unmap_file(fluid_plugin_host->context, data);
+        return ret;
+    };
 
     fluid_set_default_fileapi(&fluid_plugin_fileapi);
 }
@@ -91,23 +175,31 @@ static void fluid_plugin_shutdown()
     fluid_set_log_function(FLUID_PANIC, nullptr, nullptr);
 
     fluid_set_default_fileapi(nullptr);
+    fluid_plugin_host = nullptr;
+}
+
+static void fluid_plugin_set_host(const synth_host_interface *host)
+{
+    fluid_plugin_host = host;
 }
 
 static const char *default_soundfont_value[] = {SMF_DSP_DEFAULT_SF2, nullptr};
 
 static const synth_option the_synth_options[] = {
     {"soundfont", "List of SoundFont files to load", 'm', {.m = default_soundfont_value}},
-    {"chorus-enable", "Enable chorus effect", 'b', {.b = true}},
-    {"chorus-voices", "Chorus voice count [0:99]", 'i', {.i = 3}},
-    {"chorus-level", "Chorus level [0:10]", 'f', {.f = 2.0}},
-    {"chorus-speed", "Chorus speed (Hz) [0.29:5]", 'f', {.f = 0.3}},
-    {"chorus-depth", "Chorus depth (ms) [0:21]", 'f', {.f = 8.0}},
-    {"chorus-type", "Chorus type [0=sine;1=triangle]", 'i', {.i = 0}},
-    {"reverb-enable", "Enable reverb effect", 'b', {.b = true}},
-    {"reverb-room-size", "Reverb room size [0:1.2]", 'f', {.f = 0.2f}},
-    {"reverb-damping", "Reverb damping [0:1]", 'f', {.f = 0.0f}},
-    {"reverb-width", "Reverb width [0:100]", 'f', {.f = 0.5f}},
-    {"reverb-level", "Reverb level [0:1]", 'f', {.f = 0.9f}},
+    {"lazy-loading", "Load only the soundfonts which the song uses, at the start of each song, which interrupts the audio while it loads", 'b', {.b = false}},
+    {"chorus-enable", "Enable chorus effect", 'b', {.b = true}, SYNTH_OPTION_LIVE},
+    {"chorus-voices", "Chorus voice count [0:99]", 'i', {.i = 3}, SYNTH_OPTION_LIVE},
+    {"chorus-level", "Chorus level [0:10]", 'f', {.f = 2.0}, SYNTH_OPTION_LIVE},
+    {"chorus-speed", "Chorus speed (Hz) [0.29:5]", 'f', {.f = 0.3}, SYNTH_OPTION_LIVE},
+    {"chorus-depth", "Chorus depth (ms) [0:21]", 'f', {.f = 8.0}, SYNTH_OPTION_LIVE},
+    {"chorus-type", "Chorus type [0=sine;1=triangle]", 'i', {.i = 0}, SYNTH_OPTION_LIVE},
+    {"reverb-enable", "Enable reverb effect", 'b', {.b = true}, SYNTH_OPTION_LIVE},
+    {"reverb-room-size", "Reverb room size [0:1.2]", 'f', {.f = 0.2f}, SYNTH_OPTION_LIVE},
+    {"reverb-damping", "Reverb damping [0:1]", 'f', {.f = 0.0f}, SYNTH_OPTION_LIVE},
+    {"reverb-width", "Reverb width [0:100]", 'f', {.f = 0.5f}, SYNTH_OPTION_LIVE},
+    {"reverb-level", "Reverb level [0:1]", 'f', {.f = 0.9f}, SYNTH_OPTION_LIVE},
+    {"interpolation", "Interpolation of the samples [0=none;1=linear;4=4th order;7=7th order]", 'i', {.i = 4}, SYNTH_OPTION_LIVE},
 };
 
 static const synth_option *fluid_plugin_option(size_t index)
@@ -122,6 +214,7 @@ static synth_object *fluid_synth_instantiate(double srate)
     if (!obj)
         return nullptr;
 
+    obj->srate = srate;
     obj->soundfonts.reset(new char *[1]());
 
     fluid_settings_t *settings = new_fluid_settings();
@@ -140,6 +233,107 @@ static void fluid_synth_cleanup(synth_object *obj)
     delete sy;
 }
 
+static void fluid_synth_update_effects(fluid_synth_object *sy)
+{
+    fluid_synth_t *synth = sy->synth.get();
+
+    fluid_synth_set_chorus_on(synth, sy->chorus_enable);
+    fluid_synth_set_chorus(synth, sy->chorus_voices, sy->chorus_level, sy->chorus_speed, sy->chorus_depth, sy->chorus_type);
+    fluid_synth_set_reverb_on(synth, sy->reverb_enable);
+    fluid_synth_set_reverb(synth, sy->reverb_room_size, sy->reverb_damping, sy->reverb_width, sy->reverb_level);
+}
+
+static void fluid_synth_update_interpolation(fluid_synth_object *sy)
+{
+    int method = sy->interpolation;
+
+    // the interpolation is most of the cost of a voice, lower it under load
+    if (sy->quality < 0.5 && method > FLUID_INTERP_LINEAR)
+        method = FLUID_INTERP_LINEAR;
+
+    fluid_synth_set_interp_method(sy->synth.get(), -1, method);
+}
+
+static uint32_t fluid_read_u32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static uint16_t fluid_read_u16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static bool fluid_read_preset_table(FILE *fh, std::vector<unsigned> &presets)
+{
+    uint8_t hdr[12];
+    if (fread(hdr, 1, 12, fh) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "sfbk", 4))
+        return false;
+
+    // find the chunk LIST/pdta, skipping the sample data
+    for (;;) {
+        if (fread(hdr, 1, 12, fh) != 12)
+            return false;
+        uint32_t size = fluid_read_u32(hdr + 4);
+        if (!memcmp(hdr, "LIST", 4) && !memcmp(hdr + 8, "pdta", 4))
+            break;
+        if (fseek(fh, (long)(size + (size & 1)) - 4, SEEK_CUR) != 0)
+            return false;
+    }
+
+    // find the subchunk phdr
+    for (;;) {
+        if (fread(hdr, 1, 8, fh) != 8)
+            return false;
+        uint32_t size = fluid_read_u32(hdr + 4);
+        if (!memcmp(hdr, "phdr", 4)) {
+            // records of 38 bytes, of which the last is a terminator
+            const unsigned record_size = 38;
+            unsigned count = size / record_size;
+            uint8_t rec[record_size];
+            for (unsigned i = 0; i + 1 < count; ++i) {
+                if (fread(rec, 1, record_size, fh) != record_size)
+                    return false;
+                unsigned program = fluid_read_u16(rec + 20);
+                unsigned bank = fluid_read_u16(rec + 22);
+                presets.push_back((bank << 7) | (program & 127));
+            }
+            std::sort(presets.begin(), presets.end());
+            return true;
+        }
+        if (fseek(fh, (long)(size + (size & 1)), SEEK_CUR) != 0)
+            return false;
+    }
+}
+
+static bool fluid_soundfont_has_preset(const fluid_soundfont &font, unsigned bank, unsigned program)
+{
+    unsigned key = (bank << 7) | (program & 127);
+    return std::binary_search(font.presets.begin(), font.presets.end(), key);
+}
+
+static void fluid_load_soundfonts(fluid_synth_object *sy, const std::vector<bool> &need)
+{
+    fluid_synth_t *synth = sy->synth.get();
+    std::vector<fluid_soundfont> &fonts = sy->fonts;
+    size_t count = fonts.size();
+
+    // the font loaded last has precedence, so keep the loading order
+    size_t first_change = count;
+    for (size_t i = 0; i < count && first_change == count; ++i) {
+        if (need[i] != (fonts[i].sfid != -1))
+            first_change = i;
+    }
+
+    for (size_t i = count; i-- > first_change;) {
+        if (fonts[i].sfid != -1) {
+            Log::i("[fluid] unload soundfont: %s", fonts[i].path.c_str());
+            fluid_synth_sfunload(synth, fonts[i].sfid, true);
+            fonts[i].sfid = -1;
+        }
+    }
+
+    for (size_t i = first_change; i < count; ++i) {
+        if (need[i]) {
+            Log::i("[fluid] load soundfont: %s", fonts[i].path.c_str());
+            fonts[i].sfid = fluid_synth_sfload(synth, fonts[i].path.c_str(), true);
+        }
+    }
+}
+
 static int fluid_synth_activate(synth_object *obj)
 {
     fluid_synth_object *sy = (fluid_synth_object *)obj;
@@ -149,6 +343,9 @@ static int fluid_synth_activate(synth_object *obj)
         return -1;
     sy->synth.reset(synth);
 
+    std::vector<fluid_soundfont> &fonts = sy->fonts;
+    fonts.clear();
+
     for (char **p = sy->soundfonts.get(), *sf; (sf = *p); ++p) {
         std::string sf_absolute;
         if (!is_path_absolute(sf)) {
@@ -162,18 +359,31 @@ static int fluid_synth_activate(synth_object *obj)
             Log::e("[fluid] soundfont does not exist: %s", sf);
             continue;
         }
+
+        fluid_soundfont font;
+        font.path.assign(sf);
+        if (sy->lazy_loading && !fluid_read_preset_table(fh, font.presets)) {
+            Log::w("[fluid] cannot read the presets of soundfont: %s", sf);
+            font.presets.clear();
+        }
         fclose(fh);
 
-        Log::i("[fluid] load soundfont: %s", sf);
-        int sfid = fluid_synth_sfload(synth, sf, true);
-        if (sfid == -1)
-            /**/;
+        fonts.push_back(std::move(font));
     }
 
-    fluid_synth_set_chorus_on(synth, sy->chorus_enable);
-    fluid_synth_set_chorus(synth, sy->chorus_voices, sy->chorus_level, sy->chorus_speed, sy->chorus_depth, sy->chorus_type);
-    fluid_synth_set_reverb_on(synth, sy->reverb_enable);
-    fluid_synth_set_reverb(synth, sy->reverb_room_size, sy->reverb_damping, sy->reverb_width, sy->reverb_level);
+    // with lazy loading, defer the fonts with known presets until preload
+    std::vector<bool> need(fonts.size(), false);
+    for (size_t f = 0; f < fonts.size(); ++f)
+        need[f] = !sy->lazy_loading || fonts[f].presets.empty();
+    fluid_load_soundfonts(sy, need);
+
+    fluid_synth_update_effects(sy);
+
+    sy->quality = 1;
+    sy->polyphony = fluid_synth_get_polyphony(synth);
+    fluid_synth_update_interpolation(sy);
+
+    sy->activity.init(sy->srate);
 
     return 0;
 }
@@ -183,25 +393,61 @@ static void fluid_synth_deactivate(synth_object *obj)
     fluid_synth_object *sy = (fluid_synth_object *)obj;
 
     sy->synth.reset();
+    sy->fonts.clear();
 }
 
-static void fluid_synth_write(synth_object *obj, const unsigned char *msg, size_t size)
+static void fluid_synth_preload(synth_object *obj, const synth_midi_ins *ins, size_t count)
 {
     fluid_synth_object *sy = (fluid_synth_object *)obj;
-    fluid_synth_t *synth = sy->synth.get();
+    const std::vector<fluid_soundfont> &fonts = sy->fonts;
 
-    if (size < 1)
+    if (!sy->lazy_loading || !sy->synth)
         return;
 
-    unsigned status = msg[0];
+    // a font is needed if it provides one of the instruments, at the
+    //   highest precedence; fonts with an unknown preset table always are
+    std::vector<bool> need(fonts.size(), false);
+    for (size_t f = 0; f < fonts.size(); ++f)
+        need[f] = fonts[f].presets.empty();
+
+    for (size_t i = 0; i < count; ++i) {
+        synth_midi_ins in = ins[i];
+        // candidates in order, ending with the fallbacks for missing presets
+        const unsigned candidates[][2] = {
+            {in.percussive ? 128u : ((in.bank_msb << 7) | in.bank_lsb), in.program},
+            {in.percussive ? 128u : in.bank_msb, in.program},
+            {in.percussive ? 128u : 0u, in.percussive ? 0u : in.program},
+        };
+        bool found = false;
+        for (const unsigned *candidate : candidates) {
+            for (size_t f = fonts.size(); f-- > 0 && !found;) {
+                if (fluid_soundfont_has_preset(fonts[f], candidate[0], candidate[1])) {
+                    need[f] = true;
+                    found = true;
+                }
+            }
+            if (found)
+                break;
+        }
+    }
+
+    fluid_load_soundfonts(sy, need);
+}
+
+static void fluid_synth_dispatch(fluid_synth_t *synth, const synth_event &ev)
+{
+    if (ev.size < 1)
+        return;
+
+    unsigned status = ev.status;
 
     if (status == 0xf0)
-        fluid_synth_sysex(synth, (const char *)msg, size, nullptr, nullptr, nullptr, false);
+        fluid_synth_sysex(synth, (const char *)ev.data, ev.size, nullptr, nullptr, nullptr, false);
     else if (status == 0xff)
         fluid_synth_system_reset(synth);
     else {
-        unsigned data1 = (size > 1) ? (msg[1] & 127) : 0;
-        unsigned data2 = (size > 2) ? (msg[2] & 127) : 0;
+        unsigned data1 = ev.data1;
+        unsigned data2 = ev.data2;
         unsigned channel = status & 0x0f;
 
         switch (status & 0xf0) {
@@ -234,21 +480,177 @@ static void fluid_synth_write(synth_object *obj, const unsigned char *msg, size_
     }
 }
 
+static void fluid_synth_write(synth_object *obj, const unsigned char *msg, size_t size)
+{
+    fluid_synth_object *sy = (fluid_synth_object *)obj;
+    fluid_synth_t *synth = sy->synth.get();
+
+    fluid_synth_dispatch(synth, synth_event_decode(msg, size));
+    sy->activity.trigger();
+}
+
+// render the channel groups, directly into the channel buffers which are
+//   given, and mix them together with the effects
+static void fluid_synth_write_channels(fluid_synth_object *sy, float *mix, float *const *channels, size_t offset, size_t nframes)
+{
+    fluid_synth_t *synth = sy->synth.get();
+    float *scratch = sy->channel_scratch.get();
+    const size_t block = fluid_channel_block;
+    const unsigned count_all = fluid_channel_count + fluid_fx_count;
+
+    for (size_t index = 0; index < nframes;) {
+        size_t count = std::min(block, nframes - index);
+
+        float *left[count_all];
+        float *right[count_all];
+        for (unsigned c = 0; c < count_all; ++c) {
+            if (c < fluid_channel_count && channels && channels[2 * c]) {
+                left[c] = channels[2 * c] + offset + index;
+                right[c] = channels[2 * c + 1] + offset + index;
+            }
+            else {
+                left[c] = scratch + 2 * c * block;
+                right[c] = scratch + (2 * c + 1) * block;
+            }
+        }
+
+        fluid_synth_nwrite_float(synth, (int)count, left, right, left + fluid_channel_count, right + fluid_channel_count);
+
+        float *out = mix + 2 * index;
+        std::fill(out, out + 2 * count, 0.0f);
+        for (unsigned c = 0; c < count_all; ++c) {
+            const float *l = left[c];
+            const float *r = right[c];
+            for (size_t i = 0; i < count; ++i) {
+                out[2 * i] += l[i];
+                out[2 * i + 1] += r[i];
+            }
+        }
+
+        index += count;
+    }
+}
+
+static void fluid_synth_write_mix(fluid_synth_object *sy, float *frames, size_t nframes)
+{
+    fluid_synth_t *synth = sy->synth.get();
+
+    // with the channels in separate groups, the first group is not the mix
+    if (sy->channel_outputs)
+        fluid_synth_write_channels(sy, frames, nullptr, 0, nframes);
+    else
+        fluid_synth_write_float(synth, nframes, frames, 0, 2, frames, 1, 2);
+}
+
 static void fluid_synth_generate(synth_object *obj, float *frames, size_t nframes)
+{
+    fluid_synth_object *sy = (fluid_synth_object *)obj;
+
+    fluid_synth_write_mix(sy, frames, nframes);
+    sy->activity.analyze(frames, nframes);
+}
+
+static void fluid_synth_process(synth_object *obj, float *frames, size_t nframes, const synth_event *events, size_t nevents)
+{
+    fluid_synth_object *sy = (fluid_synth_object *)obj;
+    fluid_synth_t *synth = sy->synth.get();
+
+    synth_process_in_segments(
+        frames, nframes, events, nevents,
+        [sy](float *frames, size_t count) { fluid_synth_write_mix(sy, frames, count); },
+        [synth](const synth_event &ev) { fluid_synth_dispatch(synth, ev); });
+
+    if (nevents > 0)
+        sy->activity.trigger();
+    sy->activity.analyze(frames, nframes);
+}
+
+static int fluid_synth_enable_channel_outputs(synth_object *obj)
+{
+    fluid_synth_object *sy = (fluid_synth_object *)obj;
+    fluid_settings_t *settings = sy->settings.get();
+
+    fluid_settings_setint(settings, "synth.audio-channels", fluid_channel_count);
+    fluid_settings_setint(settings, "synth.audio-groups", fluid_channel_count);
+
+    const unsigned count_all = fluid_channel_count + fluid_fx_count;
+    sy->channel_scratch.reset(new float[2 * count_all * fluid_channel_block]);
+    sy->channel_outputs = true;
+    return 0;
+}
+
+static void fluid_synth_process_channels(synth_object *obj, float *frames, float *const *channels, size_t nframes, const synth_event *events, size_t nevents)
 {
     fluid_synth_object *sy = (fluid_synth_object *)obj;
     fluid_synth_t *synth = sy->synth.get();
 
-    fluid_synth_write_float(synth, nframes, frames, 0, 2, frames, 1, 2);
+    if (!sy->channel_outputs) {
+        fluid_synth_process(obj, frames, nframes, events, nevents);
+        return;
+    }
+
+    synth_process_in_segments(
+        frames, nframes, events, nevents,
+        [sy, frames, channels](float *segment, size_t count) {
+            fluid_synth_write_channels(sy, segment, channels, (segment - frames) / 2, count);
+        },
+        [synth](const synth_event &ev) { fluid_synth_dispatch(synth, ev); });
+
+    if (nevents > 0)
+        sy->activity.trigger();
+    sy->activity.analyze(frames, nframes);
+}
+
+static int fluid_synth_active_voices(synth_object *obj)
+{
+    fluid_synth_object *sy = (fluid_synth_object *)obj;
+    fluid_synth_t *synth = sy->synth.get();
+
+    // the voices include those in release; only the tails of the effects
+    //   need watching the output
+    int count = fluid_synth_get_active_voice_count(synth);
+    if (count == 0 && (sy->reverb_enable || sy->chorus_enable) && sy->activity.active())
+        count = 1;
+
+    return count;
+}
+
+static void fluid_synth_set_quality(synth_object *obj, double quality)
+{
+    fluid_synth_object *sy = (fluid_synth_object *)obj;
+
+    // limit the polyphony, the oldest voices get stolen first
+    const int min_polyphony = 16;
+    int polyphony = std::max(min_polyphony, (int)std::lround(quality * sy->polyphony));
+    fluid_synth_set_polyphony(sy->synth.get(), std::min(polyphony, sy->polyphony));
+
+    bool degraded = quality < 0.5;
+    bool was_degraded = sy->quality < 0.5;
+    sy->quality = quality;
+    if (degraded != was_degraded)
+        fluid_synth_update_interpolation(sy);
 }
 
 static void fluid_synth_set_option(synth_object *obj, const char *name, synth_value value)
 {
     fluid_synth_object *sy = (fluid_synth_object *)obj;
 
-    if (!strcmp(name, "soundfont"))
+    if (!strcmp(name, "soundfont")) {
         sy->soundfonts = string_list_dup(value.m);
-    else if (!strcmp(name, "chorus-enable"))
+        return;
+    }
+    if (!strcmp(name, "lazy-loading")) {
+        sy->lazy_loading = value.b;
+        return;
+    }
+    if (!strcmp(name, "interpolation")) {
+        sy->interpolation = (int)value.i;
+        if (sy->synth)
+            fluid_synth_update_interpolation(sy);
+        return;
+    }
+
+    if (!strcmp(name, "chorus-enable"))
         sy->chorus_enable = value.b;
     else if (!strcmp(name, "chorus-voices"))
         sy->chorus_voices = value.i;
@@ -270,6 +672,10 @@ static void fluid_synth_set_option(synth_object *obj, const char *name, synth_va
         sy->reverb_width = value.f;
     else if (!strcmp(name, "reverb-level"))
         sy->reverb_level = value.f;
+
+    // live change of the effect settings
+    if (sy->synth)
+        fluid_synth_update_effects(sy);
 }
 
 static const synth_interface the_synth_interface = {
@@ -285,7 +691,15 @@ static const synth_interface the_synth_interface = {
     &fluid_synth_write,
     &fluid_synth_generate,
     &fluid_synth_set_option,
+    &fluid_synth_preload,
+    &fluid_synth_process,
+    &fluid_plugin_set_host,
+    &fluid_synth_active_voices,
+    &fluid_synth_set_quality,
+    nullptr,
     nullptr,
+    &fluid_synth_enable_channel_outputs,
+    &fluid_synth_process_channels,
 };
 
 extern "C" SYNTH_EXPORT const synth_interface *synth_plugin_entry()
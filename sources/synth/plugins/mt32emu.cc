@@ -4,6 +4,7 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #include "../synth.h"
+#include "../synth_utility.h"
 #include "utility/paths.h"
 #include "utility/logs.h"
 #define MT32EMU_API_TYPE 1
@@ -31,6 +32,8 @@ struct mt32emu_synth_object {
 
 static std::string mt32emu_synth_base_dir;
 
+static const synth_host_interface *mt32emu_plugin_host;
+
 static void mt32emu_plugin_init(const char *base_dir)
 {
     mt32emu_synth_base_dir.assign(base_dir);
@@ -38,6 +41,12 @@ static void mt32emu_plugin_init(const char *base_dir)
 
 static void mt32emu_plugin_shutdown()
 {
+    mt32emu_plugin_host = nullptr;
+}
+
+static void mt32emu_plugin_set_host(const synth_host_interface *host)
+{
+    mt32emu_plugin_host = host;
 }
 
 static const synth_option the_synth_options[] = {
@@ -404,6 +413,12 @@ static void mt32emu_synth_write(synth_object *obj, const unsigned char *msg, siz
     }
 }
 
+struct mt32emu_render_job {
+    mt32emu_context device;
+    float *frames;
+    size_t nframes;
+};
+
 static void mt32emu_synth_generate(synth_object *obj, float *frames, size_t nframes)
 {
     mt32emu_synth_object *sy = (mt32emu_synth_object *)obj;
@@ -414,19 +429,42 @@ static void mt32emu_synth_generate(synth_object *obj, float *frames, size_t nfra
 
     const float gain = 0.5f; // need to attenuate a little
 
+    // the devices are independent, render them concurrently
+    mt32emu_render_job data[2];
+    synth_job jobs[2];
+    for (unsigned devno = 0; devno < 2; ++devno) {
+        data[devno].device = devices[devno].get();
+        jobs[devno].data = &data[devno];
+        jobs[devno].function = [](void *user_data) {
+            mt32emu_render_job *job = (mt32emu_render_job *)user_data;
+            mt32emu_render_float(job->device, job->frames, job->nframes);
+        };
+    }
+
     while (nframes > 0) {
         size_t frames_cur = std::min(nframes, frames_max);
-        std::fill(frames, frames + 2 * frames_cur, 0);
-        for (unsigned devno = 0; devno < 2; ++devno) {
-            mt32emu_render_float(devices[devno].get(), buffer, frames_cur);
-            for (size_t i = 0; i < 2 * frames_cur; ++i)
-                frames[i] += gain * buffer[i];
-        }
+        data[0].frames = frames;
+        data[1].frames = buffer;
+        data[0].nframes = data[1].nframes = frames_cur;
+        synth_run_jobs(mt32emu_plugin_host, jobs, 2);
+        synth_mix_add_scaled(frames, buffer, 2 * frames_cur, gain);
         frames += 2 * frames_cur;
         nframes -= frames_cur;
     }
 }
 
+static int mt32emu_synth_active_voices(synth_object *obj)
+{
+    mt32emu_synth_object *sy = (mt32emu_synth_object *)obj;
+    mt32emu_context_u *devices = sy->devices;
+
+    // the device remains active for the duration of the reverb tail
+    int count = 0;
+    for (unsigned devno = 0; devno < 2; ++devno)
+        count += mt32emu_is_active(devices[devno].get()) ? 1 : 0;
+    return count;
+}
+
 static void mt32emu_synth_set_option(synth_object *obj, const char *name, synth_value value)
 {
     mt32emu_synth_object *sy = (mt32emu_synth_object *)obj;
@@ -441,6 +479,12 @@ static void mt32emu_synth_set_option(synth_object *obj, const char *name, synth_
         sy->partial_count = value.i;
 }
 
+// the rate of the analog output stage, which mt32emu converts otherwise
+static double mt32emu_plugin_preferred_rate()
+{
+    return mt32emu_get_stereo_output_samplerate(MT32EMU_AOM_COARSE);
+}
+
 static const synth_interface the_synth_interface = {
     SYNTH_ABI_VERSION,
     "MT32EMU",
@@ -455,6 +499,14 @@ static const synth_interface the_synth_interface = {
     &mt32emu_synth_generate,
     &mt32emu_synth_set_option,
     nullptr,
+    nullptr,
+    &mt32emu_plugin_set_host,
+    &mt32emu_synth_active_voices,
+    nullptr,
+    nullptr,
+    &mt32emu_plugin_preferred_rate,
+    nullptr,
+    nullptr,
 };
 
 extern "C" SYNTH_EXPORT const synth_interface *synth_plugin_entry()
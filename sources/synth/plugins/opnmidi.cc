@@ -4,13 +4,18 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #include "../synth.h"
+#include "../synth_utility.h"
 #include "utility/paths.h"
 #include "utility/logs.h"
 #include <opnmidi.h>
 #include <algorithm>
+#include <vector>
 #include <memory>
 #include <cstring>
+#include <cstdlib>
+#include <chrono>
 #include <cctype>
+#include <cstdio>
 
 ///
 struct OPN2_MIDIPlayer_delete { void operator()(OPN2_MIDIPlayer *x) const { opn2_close(x); } };
@@ -19,17 +24,35 @@ typedef std::unique_ptr<OPN2_MIDIPlayer, OPN2_MIDIPlayer_delete> OPN2_MIDIPlayer
 ///
 struct opnmidi_synth_object {
     double srate = 0;
-    OPN2_MIDIPlayer_u player;
+    std::vector<OPN2_MIDIPlayer_u> players;
+    std::unique_ptr<float[]> mix_buffer;
+    synth_activity_monitor activity;
+    // the channel states of a player, as the library describes them
+    std::vector<char> channel_text;
+    std::vector<char> channel_attr;
 
     int chip_count = 0;
     std::string instrument_bank;
     std::string emulator;
     std::string volume_model;
     bool automatic_arpeggio = true;
+    int parallel_players = 1;
+    double cpu_budget = 0;
 };
 
+// limits of the rendering of players in parallel
+static constexpr unsigned opnmidi_max_players = 8;
+static constexpr unsigned opnmidi_mix_frames = 256;
+// FM channels of an OPN2 chip, which has no rhythm channels
+static constexpr unsigned opnmidi_chip_channels = 6;
+
 static std::string opnmidi_synth_base_dir;
 
+static const synth_host_interface *opnmidi_plugin_host;
+
+// external banks, which stay mapped across activations
+static synth_file_cache opnmidi_bank_files;
+
 static void opnmidi_plugin_init(const char *base_dir)
 {
     opnmidi_synth_base_dir.assign(base_dir);
@@ -37,14 +60,23 @@ static void opnmidi_plugin_init(const char *base_dir)
 
 static void opnmidi_plugin_shutdown()
 {
+    opnmidi_bank_files.clear(opnmidi_plugin_host);
+    opnmidi_plugin_host = nullptr;
+}
+
+static void opnmidi_plugin_set_host(const synth_host_interface *host)
+{
+    opnmidi_plugin_host = host;
 }
 
 static const synth_option the_synth_options[] = {
     {"chip-count", "Number of emulated chips", 'i', {.i = 4}},
     {"instrument-bank", "Bank number, or WOPN file path", 's', {.s = "0"}},
-    {"emulator", "Name of the chip emulator", 's', {.s = "mame"}},
+    {"emulator", "Name of the chip emulator, or \"auto\" to choose by the CPU cost", 's', {.s = "mame"}},
     {"volume-model", "Name of the volume model", 's', {.s = "auto"}},
-    {"automatic-arpeggio", "Enable the automatic arpeggio system", 'b', {.b = true}},
+    {"automatic-arpeggio", "Enable the automatic arpeggio system", 'b', {.b = true}, SYNTH_OPTION_LIVE},
+    {"parallel-players", "Number of players which share the chips and the channels, rendered in parallel [1:8]", 'i', {.i = 1}},
+    {"cpu-budget", "Fraction of a CPU core for the chips of a player, if the emulator is automatic", 'f', {.f = 0.25}},
 };
 
 struct named_emulator {
@@ -63,6 +95,24 @@ static const named_emulator the_emulators[] = {
     {"pmdwin", OPNMIDI_EMU_PMDWIN},
 };
 
+// emulators by decreasing accuracy, for the automatic choice
+static const char *const the_accurate_emulators[] = {"nuked", "gx", "mame", "gens"};
+
+struct opnmidi_embedded_bank {
+    const char *name;
+    const uint8_t *data;
+    unsigned long size;
+};
+
+static const uint8_t opnmidi_bank_xg[] = {
+    #include "opnmidi_bank.dat"
+};
+
+// banks selectable by number, in this order
+static const opnmidi_embedded_bank the_embedded_banks[] = {
+    {"XG bank by Wohlstand", opnmidi_bank_xg, sizeof(opnmidi_bank_xg)},
+};
+
 struct named_volume_model {
     const char *name;
     int value;
@@ -100,14 +150,12 @@ static void opnmidi_synth_cleanup(synth_object *obj)
     delete sy;
 }
 
-static int opnmidi_synth_activate(synth_object *obj)
+static OPN2_MIDIPlayer *opnmidi_create_player(opnmidi_synth_object *sy, const std::string &emulator_name, int chip_count)
 {
-    opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
-
-    OPN2_MIDIPlayer *player = opn2_init(sy->srate);
+    OPN2_MIDIPlayer_u player_u(opn2_init(sy->srate));
+    OPN2_MIDIPlayer *player = player_u.get();
     if (!player)
-        return -1;
-    sy->player.reset(player);
+        return nullptr;
 
     auto str_to_lower = [](std::string text) -> std::string {
         std::transform(text.begin(), text.end(), text.begin(),
@@ -119,13 +167,13 @@ static int opnmidi_synth_activate(synth_object *obj)
     int emulator = -1;
     const unsigned num_emulators = sizeof(the_emulators) / sizeof(the_emulators[0]);
 
-    const std::string emu_id = str_to_lower(sy->emulator);
+    const std::string emu_id = str_to_lower(emulator_name);
     for (unsigned i = 0; i < num_emulators && emulator == -1; ++i) {
         if (emu_id == the_emulators[i].name)
             emulator = the_emulators[i].value;
     }
     if (emulator == -1) {
-        Log::e("opnmidi: cannot find an emulator named \"%s\"", sy->emulator.c_str());
+        Log::e("opnmidi: cannot find an emulator named \"%s\"", emulator_name.c_str());
         emulator = the_emulators[0].value;
     }
 
@@ -147,8 +195,8 @@ static int opnmidi_synth_activate(synth_object *obj)
     if (opn2_switchEmulator(player, emulator) != 0)
         Log::e("opnmidi: cannot set emulator");
 
-    if (opn2_setNumChips(player, sy->chip_count) != 0)
-        Log::e("opnmidi: cannot set chip count %d", sy->chip_count);
+    if (opn2_setNumChips(player, chip_count) != 0)
+        Log::e("opnmidi: cannot set chip count %d", chip_count);
 
     Log::i("opnmidi: use %d chips \"%s\"", opn2_getNumChips(player), opn2_chipEmulatorName(player));
 
@@ -156,13 +204,14 @@ static int opnmidi_synth_activate(synth_object *obj)
     unsigned scan_count = 0;
     if (sscanf(sy->instrument_bank.c_str(), "%d%n", &bank_no, &scan_count) == 1 && scan_count == sy->instrument_bank.size()) {
         Log::i("opnmidi: set bank number %d", bank_no);
-        #pragma message("TODO opnmidi: no library support for embedded banks")
+        // the library has no banks of its own, use the embedded ones
+        const unsigned num_banks = sizeof(the_embedded_banks) / sizeof(the_embedded_banks[0]);
         bool loaded = false;
-        if (bank_no == 0) {
-            const uint8_t bank_data[] = {
-                #include "opnmidi_bank.dat"
-            };
-            loaded = opn2_openBankData(player, bank_data, sizeof(bank_data)) == 0;
+        if (bank_no >= 0 && (unsigned)bank_no < num_banks) {
+            const opnmidi_embedded_bank &bank = the_embedded_banks[bank_no];
+            loaded = opn2_openBankData(player, bank.data, bank.size) == 0;
+            if (loaded)
+                Log::i("opnmidi: use embedded bank \"%s\"", bank.name);
         }
         if (!loaded)
             Log::e("opnmidi: cannot set bank number %d", bank_no);
@@ -172,86 +221,251 @@ static int opnmidi_synth_activate(synth_object *obj)
         if (!is_path_absolute(path))
             path = opnmidi_synth_base_dir + path;
         Log::i("opnmidi: set bank file %s", path.c_str());
-        if (opn2_openBankFile(player, path.c_str()) != 0)
+        size_t size = 0;
+        const void *data = opnmidi_bank_files.map(opnmidi_plugin_host, path, &size);
+        int result = data ? opn2_openBankData(player, data, (unsigned long)size) : opn2_openBankFile(player, path.c_str());
+        if (result != 0)
             Log::e("opnmidi: cannot set bank file \"%s\"", path.c_str());
     }
 
     opn2_setAutoArpeggio(player, sy->automatic_arpeggio);
 
-    return 0;
+    return player_u.release();
 }
 
-static void opnmidi_synth_deactivate(synth_object *obj)
+static int opnmidi_player_chips(int chip_count, unsigned player_count, unsigned index)
+{
+    // distribute the chips evenly, with at least one per player
+    int chips = chip_count / (int)player_count + ((int)index < chip_count % (int)player_count);
+    return (chips > 1) ? chips : 1;
+}
+
+static void opnmidi_render(OPN2_MIDIPlayer *player, float *frames, size_t nframes);
+
+static int opnmidi_sounding_channels(OPN2_MIDIPlayer *player, char *text, char *attr, size_t size)
+{
+    // the chip channels which hold a note, where anything but '-' denotes a
+    //   user: keyed on, sustained by either pedal, or shared by arpeggio
+    int count = 0;
+    if (opn2_describeChannels(player, text, attr, size) == 0) {
+        for (size_t i = 0; i < size && text[i]; ++i)
+            count += text[i] != '-';
+    }
+    return count;
+}
+
+static double opnmidi_measure_emulator(double srate, int emulator)
+{
+    // time to render one second with a chip, having all its voices in use
+    OPN2_MIDIPlayer_u player(opn2_init((long)srate));
+    if (!player || opn2_switchEmulator(player.get(), emulator) != 0 || opn2_setNumChips(player.get(), 1) != 0)
+        return -1;
+
+    // the library has no banks of its own, without one the notes are silent
+    const opnmidi_embedded_bank &bank = the_embedded_banks[0];
+    if (opn2_openBankData(player.get(), bank.data, bank.size) != 0)
+        return -1;
+
+    for (unsigned channel = 0; channel < 16; ++channel) {
+        if (channel == 9)
+            continue;
+        opn2_rt_patchChange(player.get(), channel, 8 * channel);
+        for (unsigned note = 48; note < 72; note += 7)
+            opn2_rt_noteOn(player.get(), channel, note, 100);
+    }
+
+    char text[opnmidi_chip_channels + 1];
+    char attr[opnmidi_chip_channels + 1];
+    if (opnmidi_sounding_channels(player.get(), text, attr, sizeof(text)) == 0) {
+        Log::w("opnmidi: no voice sounds to measure the emulator");
+        return -1;
+    }
+
+    // a quarter of a second is enough, and the audio waits during this
+    constexpr size_t block_frames = 256;
+    float block[2 * block_frames];
+    const size_t block_count = (size_t)srate / (4 * block_frames);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < block_count; ++i)
+        opnmidi_render(player.get(), block, block_frames);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    return elapsed.count() * srate / (double)(block_count * block_frames);
+}
+
+static std::string opnmidi_choose_emulator(opnmidi_synth_object *sy, int chip_count)
+{
+    const unsigned num_emulators = sizeof(the_emulators) / sizeof(the_emulators[0]);
+    const unsigned num_candidates = sizeof(the_accurate_emulators) / sizeof(the_accurate_emulators[0]);
+
+    const char *cheapest = the_accurate_emulators[num_candidates - 1];
+    double cheapest_cost = -1;
+
+    for (unsigned c = 0; c < num_candidates; ++c) {
+        const char *name = the_accurate_emulators[c];
+        int emulator = -1;
+        for (unsigned i = 0; i < num_emulators && emulator == -1; ++i) {
+            if (!strcmp(name, the_emulators[i].name))
+                emulator = the_emulators[i].value;
+        }
+
+        // measured on first use, and kept for the next runs; the key
+        //   differs from the measurements which were made without a bank
+        char key[64];
+        sprintf(key, "cost-%s@%ld", name, (long)sy->srate);
+        double cost = -1;
+        std::string cached;
+        if (synth_cache_get(opnmidi_plugin_host, "opnmidi", key, cached))
+            cost = std::atof(cached.c_str());
+        else {
+            Log::i("opnmidi: measure the cost of emulator \"%s\"", name);
+            cost = opnmidi_measure_emulator(sy->srate, emulator);
+            if (cost > 0)
+                synth_cache_set(opnmidi_plugin_host, "opnmidi", key, std::to_string(cost).c_str());
+        }
+
+        if (cost <= 0)
+            continue;
+
+        Log::i("opnmidi: emulator \"%s\" uses %.1f%% CPU with %d chips", name, 100 * cost * chip_count, chip_count);
+        if (cost * chip_count <= sy->cpu_budget)
+            return name;
+
+        if (cheapest_cost < 0 || cost < cheapest_cost) {
+            cheapest = name;
+            cheapest_cost = cost;
+        }
+    }
+
+    Log::w("opnmidi: no emulator fits the CPU budget, use the least costly");
+    return cheapest;
+}
+
+static int opnmidi_synth_activate(synth_object *obj)
 {
     opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
-    sy->player.reset();
+
+    unsigned count = (unsigned)std::max(1, std::min(sy->parallel_players, sy->chip_count));
+    count = std::min(count, opnmidi_max_players);
+
+    // the players run in parallel, the budget applies to the largest
+    std::string emulator = sy->emulator;
+    if (emulator == "auto") {
+        emulator = opnmidi_choose_emulator(sy, opnmidi_player_chips(sy->chip_count, count, 0));
+        Log::i("opnmidi: choose emulator \"%s\"", emulator.c_str());
+    }
+
+    for (unsigned i = 0; i < count; ++i) {
+        OPN2_MIDIPlayer *player = opnmidi_create_player(sy, emulator, opnmidi_player_chips(sy->chip_count, count, i));
+        if (!player) {
+            sy->players.clear();
+            return -1;
+        }
+        sy->players.emplace_back(player);
+    }
+
+    if (count > 1) {
+        Log::i("opnmidi: render %u players in parallel", count);
+        sy->mix_buffer.reset(new float[2 * opnmidi_mix_frames * (count - 1)]);
+    }
+
+    size_t channel_count = opnmidi_chip_channels * opnmidi_player_chips(sy->chip_count, count, 0);
+    sy->channel_text.assign(channel_count + 1, 0);
+    sy->channel_attr.assign(channel_count + 1, 0);
+
+    sy->activity.init(sy->srate);
+
+    return 0;
 }
 
-static void opnmidi_synth_write(synth_object *obj, const unsigned char *msg, size_t size)
+static void opnmidi_synth_deactivate(synth_object *obj)
 {
     opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
-    OPN2_MIDIPlayer *player = sy->player.get();
+    sy->players.clear();
+    sy->mix_buffer.reset();
+}
 
-    if (size <= 0)
+static void opnmidi_synth_dispatch(OPN2_MIDIPlayer *player, const synth_event &ev)
+{
+    if (ev.size <= 0)
         return;
 
-    unsigned status = msg[0];
+    unsigned status = ev.status;
     if (status == 0xf0) {
-        opn2_rt_systemExclusive(player, msg, size);
+        opn2_rt_systemExclusive(player, ev.data, ev.size);
         return;
     }
 
     unsigned channel = status & 0x0f;
     switch (status >> 4) {
     case 0b1001: {
-        if (size < 3) break;
-        unsigned vel = msg[2] & 0x7f;
+        if (ev.size < 3) break;
+        unsigned vel = ev.data2;
         if (vel != 0) {
-            unsigned note = msg[1] & 0x7f;
+            unsigned note = ev.data1;
             opn2_rt_noteOn(player, channel, note, vel);
             break;
         }
     }
     case 0b1000: {
-        if (size < 3) break;
-        unsigned note = msg[1] & 0x7f;
+        if (ev.size < 3) break;
+        unsigned note = ev.data1;
         opn2_rt_noteOff(player, channel, note);
         break;
     }
     case 0b1010:
-        if (size < 3) break;
-        opn2_rt_noteAfterTouch(player, channel, msg[1] & 0x7f, msg[2] & 0x7f);
+        if (ev.size < 3) break;
+        opn2_rt_noteAfterTouch(player, channel, ev.data1, ev.data2);
         break;
     case 0b1101:
-        if (size < 2) break;
-        opn2_rt_channelAfterTouch(player, channel, msg[1] & 0x7f);
+        if (ev.size < 2) break;
+        opn2_rt_channelAfterTouch(player, channel, ev.data1);
         break;
     case 0b1011: {
-        if (size < 3) break;
-        unsigned cc = msg[1] & 0x7f;
-        unsigned val = msg[2] & 0x7f;
+        if (ev.size < 3) break;
+        unsigned cc = ev.data1;
+        unsigned val = ev.data2;
         opn2_rt_controllerChange(player, channel, cc, val);
         break;
     }
     case 0b1100: {
-        if (size < 2) break;
-        unsigned pgm = msg[1] & 0x7f;
+        if (ev.size < 2) break;
+        unsigned pgm = ev.data1;
         opn2_rt_patchChange(player, channel, pgm);
         break;
     }
     case 0b1110:
-        if (size < 3) break;
-        unsigned value = (msg[1] & 0x7f) | ((msg[2] & 0x7f) << 7);
+        if (ev.size < 3) break;
+        unsigned value = ev.data1 | (ev.data2 << 7);
         opn2_rt_pitchBend(player, channel, value);
         break;
     }
 }
 
-static void opnmidi_synth_generate(synth_object *obj, float *frames, size_t nframes)
+static void opnmidi_synth_route(opnmidi_synth_object *sy, const synth_event &ev)
+{
+    size_t count = sy->players.size();
+
+    // channel messages go to the player of the channel, others to all
+    if (ev.status >= 0x80 && ev.status < 0xf0)
+        opnmidi_synth_dispatch(sy->players[(ev.status & 0x0f) % count].get(), ev);
+    else {
+        for (size_t i = 0; i < count; ++i)
+            opnmidi_synth_dispatch(sy->players[i].get(), ev);
+    }
+}
+
+static void opnmidi_synth_write(synth_object *obj, const unsigned char *msg, size_t size)
 {
     opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
-    OPN2_MIDIPlayer *player = sy->player.get();
 
+    opnmidi_synth_route(sy, synth_event_decode(msg, size));
+    sy->activity.trigger();
+}
+
+static void opnmidi_render(OPN2_MIDIPlayer *player, float *frames, size_t nframes)
+{
     OPNMIDI_AudioFormat format;
     format.type = OPNMIDI_SampleType_F32;
     format.containerSize = sizeof(float);
@@ -259,10 +473,97 @@ static void opnmidi_synth_generate(synth_object *obj, float *frames, size_t nfra
     opn2_generateFormat(player, 2 * nframes, (OPN2_UInt8 *)frames, (OPN2_UInt8 *)(frames + 1), &format);
 }
 
+struct opnmidi_render_job {
+    OPN2_MIDIPlayer *player;
+    float *frames;
+    size_t nframes;
+};
+
+static void opnmidi_render_all(opnmidi_synth_object *sy, float *frames, size_t nframes)
+{
+    size_t count = sy->players.size();
+
+    if (count == 1) {
+        opnmidi_render(sy->players[0].get(), frames, nframes);
+        return;
+    }
+
+    // the first player renders to the output, the others get mixed into it
+    opnmidi_render_job data[opnmidi_max_players];
+    synth_job jobs[opnmidi_max_players];
+    float *mix = sy->mix_buffer.get();
+
+    while (nframes > 0) {
+        size_t segment = std::min<size_t>(nframes, opnmidi_mix_frames);
+
+        for (size_t i = 0; i < count; ++i) {
+            data[i].player = sy->players[i].get();
+            data[i].frames = (i == 0) ? frames : (mix + 2 * opnmidi_mix_frames * (i - 1));
+            data[i].nframes = segment;
+            jobs[i].data = &data[i];
+            jobs[i].function = [](void *user_data) {
+                opnmidi_render_job *job = (opnmidi_render_job *)user_data;
+                opnmidi_render(job->player, job->frames, job->nframes);
+            };
+        }
+
+        synth_run_jobs(opnmidi_plugin_host, jobs, count);
+
+        for (size_t i = 1; i < count; ++i)
+            synth_mix_add(frames, data[i].frames, 2 * segment);
+
+        frames += 2 * segment;
+        nframes -= segment;
+    }
+}
+
+static void opnmidi_synth_generate(synth_object *obj, float *frames, size_t nframes)
+{
+    opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
+
+    opnmidi_render_all(sy, frames, nframes);
+    sy->activity.analyze(frames, nframes);
+}
+
+static void opnmidi_synth_process(synth_object *obj, float *frames, size_t nframes, const synth_event *events, size_t nevents)
+{
+    opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
+
+    synth_process_in_segments(
+        frames, nframes, events, nevents,
+        [sy](float *frames, size_t count) { opnmidi_render_all(sy, frames, count); },
+        [sy](const synth_event &ev) { opnmidi_synth_route(sy, ev); });
+
+    if (nevents > 0)
+        sy->activity.trigger();
+    sy->activity.analyze(frames, nframes);
+}
+
+static int opnmidi_synth_active_voices(synth_object *obj)
+{
+    opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
+    char *text = sy->channel_text.data();
+    char *attr = sy->channel_attr.data();
+    size_t size = sy->channel_text.size();
+
+    int count = 0;
+    for (const OPN2_MIDIPlayer_u &player : sy->players)
+        count += opnmidi_sounding_channels(player.get(), text, attr, size);
+
+    // notes which are released still sound until the envelope ends, which
+    //   the library does not tell, so watch the output then
+    if (count == 0 && sy->activity.active())
+        count = 1;
+
+    return count;
+}
+
 static void opnmidi_synth_set_option(synth_object *obj, const char *name, synth_value value)
 {
     opnmidi_synth_object *sy = (opnmidi_synth_object *)obj;
 
+    unsigned count = (unsigned)sy->players.size();
+
     if (!strcmp(name, "chip-count"))
         sy->chip_count = value.i;
     else if (!strcmp(name, "instrument-bank"))
@@ -271,8 +572,21 @@ static void opnmidi_synth_set_option(synth_object *obj, const char *name, synth_
         sy->emulator.assign(value.s);
     else if (!strcmp(name, "volume-model"))
         sy->volume_model.assign(value.s);
-    else if (!strcmp(name, "automatic-arpeggio"))
+    else if (!strcmp(name, "automatic-arpeggio")) {
         sy->automatic_arpeggio = value.b;
+        for (unsigned i = 0; i < count; ++i)
+            opn2_setAutoArpeggio(sy->players[i].get(), sy->automatic_arpeggio);
+    }
+    else if (!strcmp(name, "parallel-players"))
+        sy->parallel_players = (int)std::max(1L, std::min((long)opnmidi_max_players, value.i));
+    else if (!strcmp(name, "cpu-budget"))
+        sy->cpu_budget = value.f;
+}
+
+// the OPN2 runs at its clock rate of 7.67 MHz divided by 144
+static double opnmidi_plugin_preferred_rate()
+{
+    return 53267;
 }
 
 static const synth_interface the_synth_interface = {
@@ -289,6 +603,14 @@ static const synth_interface the_synth_interface = {
     &opnmidi_synth_generate,
     &opnmidi_synth_set_option,
     nullptr,
+    &opnmidi_synth_process,
+    &opnmidi_plugin_set_host,
+    &opnmidi_synth_active_voices,
+    nullptr,
+    nullptr,
+    &opnmidi_plugin_preferred_rate,
+    nullptr,
+    nullptr,
 };
 
 extern "C" SYNTH_EXPORT const synth_interface *synth_plugin_entry()
@@ -4,6 +4,7 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #include "../synth.h"
+#include "../synth_utility.h"
 #include "utility/paths.h"
 #include "utility/logs.h"
 #include <emidi_alpha/CMIDIModule.hpp>
@@ -20,6 +21,8 @@ struct scc_synth_object {
 
     dsa::CMIDIModule module[16];
     std::unique_ptr<dsa::ISoundDevice> device[16];
+
+    synth_activity_monitor activity;
 };
 
 static void scc_plugin_init(const char *base_dir)
@@ -74,6 +77,8 @@ static int scc_synth_activate(synth_object *obj)
         sy->module[m].Reset();
     }
 
+    sy->activity.init(srate);
+
     return 0;
 }
 
@@ -139,6 +144,8 @@ static void scc_synth_write(synth_object *obj, const unsigned char *msg, size_t
     sy->module[(mm.m_ch * 2) % mods].SendMIDIMsg(mm);
     if (mm.m_ch != 9)
         sy->module[(mm.m_ch * 2 + 1) % mods].SendMIDIMsg(mm);
+
+    sy->activity.trigger();
 }
 
 static void scc_synth_generate(synth_object *obj, float *frames, size_t nframes)
@@ -157,6 +164,14 @@ static void scc_synth_generate(synth_object *obj, float *frames, size_t nframes)
             frames[2 * i + 1] += b[1] * (1.0f / 32768);
         }
     }
+
+    sy->activity.analyze(frames, nframes);
+}
+
+static int scc_synth_active_voices(synth_object *obj)
+{
+    scc_synth_object *sy = (scc_synth_object *)obj;
+    return sy->activity.active() ? 1 : 0;
 }
 
 static void scc_synth_set_option(synth_object *obj, const char *name, synth_value value)
@@ -181,6 +196,14 @@ static const synth_interface the_synth_interface = {
     &scc_synth_generate,
     &scc_synth_set_option,
     nullptr,
+    nullptr,
+    nullptr,
+    &scc_synth_active_voices,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
 };
 
 extern "C" SYNTH_EXPORT const synth_interface *synth_plugin_entry()
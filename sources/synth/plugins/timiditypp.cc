@@ -11,7 +11,13 @@
 #include <timiditypp/timidity.h>
 #include <timiditypp/instrum.h>
 #include <timiditypp/playmidi.h>
+#include <unordered_map>
+#include <algorithm>
+#include <vector>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
 #include <cstdlib>
 #include <cstdarg>
 #include <cstring>
@@ -51,15 +57,126 @@ static void timiditypp_print_message(int type, int verbosity_level, const char*
 }
 
 ///
+class timiditypp_soundfont_reader;
+
+// a player which renders a subset of channels
+struct timiditypp_part {
+    std::unique_ptr<TimidityPlus::Player> player;
+};
+
 struct timiditypp_synth_object {
+    double srate = 0;
+    synth_activity_monitor activity;
     string_list_ptr soundfonts;
-    std::unique_ptr<MusicIO::FileSystemSoundFontReader> reader;
+    int parallel_players = 1;
+    // the players share the instruments, which load only while processing
+    //   the events, one player at a time, and not during the rendering
+    std::unique_ptr<timiditypp_soundfont_reader> reader;
     std::unique_ptr<TimidityPlus::Instruments> instruments;
-    std::unique_ptr<TimidityPlus::Player> player;
+    std::vector<timiditypp_part> parts;
+    std::unique_ptr<float[]> mix_buffer;
+
+    // the preload runs in the background, one instrument at a time,
+    //   taking turns with the processing; the processing does not wait for
+    //   it, instead it renders silence and keeps the events for later
+    std::mutex mutex;
+    std::vector<unsigned char> pending_events;
+    std::atomic<unsigned> pending_dropped{0};
+    std::thread preload_thread;
+    std::atomic_bool preload_cancel{false};
+    std::atomic<int> preload_progress{-1};
 };
 
+// limits of the rendering of players in parallel
+static constexpr unsigned timiditypp_max_players = 8;
+static constexpr unsigned timiditypp_mix_frames = 256;
+// capacity of the events kept while the preload holds the lock
+static constexpr unsigned timiditypp_pending_capacity = 16384;
+
 static std::string timiditypp_synth_base_dir;
 
+static const synth_host_interface *timiditypp_plugin_host;
+
+///
+class timiditypp_soundfont_reader : public MusicIO::FileSystemSoundFontReader {
+public:
+    explicit timiditypp_soundfont_reader(timiditypp_synth_object &sy)
+        : FileSystemSoundFontReader("timidity.cfg")
+    {
+        std::string &config = config_;
+        config.reserve(1024);
+
+        for (char **p = sy.soundfonts.get(), *sf; (sf = *p); ++p) {
+            std::string sf_absolute;
+            if (!is_path_absolute(sf)) {
+                sf_absolute = timiditypp_synth_base_dir + sf;
+                sf = (char *)sf_absolute.c_str();
+            }
+            config.append("soundfont \"");
+            config.append(sf);
+            config.append("\"\n");
+        }
+    }
+
+    ~timiditypp_soundfont_reader()
+    {
+        const synth_host_interface *host = timiditypp_plugin_host;
+        if (!host)
+            return;
+        for (const auto &item : mapped_files_)
+            host->unmap_file(host->context, item.second.first);
+    }
+
+    MusicIO::FileInterface *open_file(const char *fn) override
+    {
+        if (!fn)
+            return new MusicIO::MemoryReader(
+                (const uint8_t *)config_.c_str(), (long)config_.size());
+        else if (MusicIO::FileInterface *file = open_mapped_file(fn))
+            return file;
+        else
+            return FileSystemSoundFontReader::open_file(fn);
+    }
+
+    void close() override
+    {
+    }
+
+    void prefetch()
+    {
+        const synth_host_interface *host = timiditypp_plugin_host;
+        if (!host || !host->prefetch_file)
+            return;
+        for (const auto &item : mapped_files_)
+            host->prefetch_file(host->context, item.second.first, item.second.second);
+    }
+
+private:
+    // the soundfont gets reopened as instruments load, keep it mapped
+    MusicIO::FileInterface *open_mapped_file(const char *fn)
+    {
+        const synth_host_interface *host = timiditypp_plugin_host;
+        if (!host || !host->map_file)
+            return nullptr;
+
+        auto it = mapped_files_.find(fn);
+        if (it == mapped_files_.end()) {
+            size_t size = 0;
+            const void *data = host->map_file(host->context, fn, &size);
+            if (!data)
+                return nullptr;
+            it = mapped_files_.emplace(fn, std::make_pair(data, size)).first;
+        }
+
+        return new MusicIO::MemoryReader(
+            (const uint8_t *)it->second.first, (long)it->second.second);
+    }
+
+private:
+    std::string config_;
+    std::unordered_map<std::string, std::pair<const void *, size_t>> mapped_files_;
+};
+
 static void timiditypp_plugin_init(const char *base_dir)
 {
     timiditypp_synth_base_dir.assign(base_dir);
@@ -68,12 +185,19 @@ static void timiditypp_plugin_init(const char *base_dir)
 
 static void timiditypp_plugin_shutdown()
 {
+    timiditypp_plugin_host = nullptr;
+}
+
+static void timiditypp_plugin_set_host(const synth_host_interface *host)
+{
+    timiditypp_plugin_host = host;
 }
 
 static const char *default_soundfont_value[] = {SMF_DSP_DEFAULT_SF2, nullptr};
 
 static const synth_option the_synth_options[] = {
     {"soundfont", "List of SoundFont files to load", 'm', {.m = default_soundfont_value}},
+    {"parallel-players", "Number of players which share the channels, rendered in parallel [1:8]", 'i', {.i = 1}},
 };
 
 static const synth_option *timiditypp_plugin_option(size_t index)
@@ -88,6 +212,7 @@ static synth_object *timiditypp_synth_instantiate(double srate)
     if (!obj)
         return nullptr;
 
+    obj->srate = srate;
     obj->soundfonts.reset(new char *[1]());
 
     TimidityPlus::set_playback_rate(srate);
@@ -95,9 +220,20 @@ static synth_object *timiditypp_synth_instantiate(double srate)
     return (synth_object *)obj.release();
 }
 
+static void timiditypp_stop_preload(timiditypp_synth_object *sy)
+{
+    if (sy->preload_thread.joinable()) {
+        sy->preload_cancel.store(true);
+        sy->preload_thread.join();
+        sy->preload_cancel.store(false);
+    }
+    sy->preload_progress.store(-1);
+}
+
 static void timiditypp_synth_cleanup(synth_object *obj)
 {
     timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
+    timiditypp_stop_preload(sy);
     delete sy;
 }
 
@@ -109,56 +245,33 @@ static int timiditypp_synth_activate(synth_object *obj)
     sy->instruments.reset(instruments);
 
     ///
-    class Reader : public MusicIO::FileSystemSoundFontReader {
-    public:
-        explicit Reader(timiditypp_synth_object &sy)
-            : FileSystemSoundFontReader("timidity.cfg")
-        {
-            std::string &config = config_;
-            config.reserve(1024);
-
-            for (char **p = sy.soundfonts.get(), *sf; (sf = *p); ++p) {
-                std::string sf_absolute;
-                if (!is_path_absolute(sf)) {
-                    sf_absolute = timiditypp_synth_base_dir + sf;
-                    sf = (char *)sf_absolute.c_str();
-                }
-                config.append("soundfont \"");
-                config.append(sf);
-                config.append("\"\n");
-            }
-        }
-
-        MusicIO::FileInterface *open_file(const char *fn) override
-        {
-            if (!fn)
-                return new MusicIO::MemoryReader(
-                    (const uint8_t *)config_.c_str(), (long)config_.size());
-            else
-                return FileSystemSoundFontReader::open_file(fn);
-        }
-
-        void close() override
-        {
-        }
-
-    private:
-        std::string config_;
-    };
-
-    ///
-    Reader *reader = new Reader(*sy);
+    timiditypp_soundfont_reader *reader = new timiditypp_soundfont_reader(*sy);
     sy->reader.reset(reader);
 
     if (!instruments->load(reader))
         Log::e("[timidity++] cannot load the soundfont configuration");
 
     ///
-    TimidityPlus::Player *player = new TimidityPlus::Player(instruments);
-    sy->player.reset(player);
+    unsigned count = (unsigned)sy->parallel_players;
+    sy->parts.resize(count);
 
-    ///
-    player->playmidi_stream_init();
+    for (timiditypp_part &part : sy->parts) {
+        TimidityPlus::Player *player = new TimidityPlus::Player(instruments);
+        part.player.reset(player);
+
+        ///
+        player->playmidi_stream_init();
+    }
+
+    if (count > 1) {
+        Log::i("[timidity++] render %u players in parallel", count);
+        sy->mix_buffer.reset(new float[2 * timiditypp_mix_frames * (count - 1)]);
+    }
+
+    sy->pending_events.clear();
+    sy->pending_events.reserve(timiditypp_pending_capacity);
+
+    sy->activity.init(sy->srate);
 
     return 0;
 }
@@ -167,16 +280,19 @@ static void timiditypp_synth_deactivate(synth_object *obj)
 {
     timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
 
-    sy->player.reset();
+    timiditypp_stop_preload(sy);
+
+    if (unsigned dropped = sy->pending_dropped.exchange(0))
+        Log::w("[timidity++] dropped %u events while the preload held the synth", dropped);
+
+    sy->parts.clear();
     sy->instruments.reset();
     sy->reader.reset();
+    sy->mix_buffer.reset();
 }
 
-static void timiditypp_synth_write(synth_object *obj, const unsigned char *msg, size_t size)
+static void timiditypp_synth_dispatch(TimidityPlus::Player &player, const unsigned char *msg, size_t size)
 {
-    timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
-    TimidityPlus::Player &player = *sy->player;
-
     uint8_t status = 0;
     uint8_t data1 = 0;
     uint8_t data2 = 0;
@@ -198,12 +314,173 @@ static void timiditypp_synth_write(synth_object *obj, const unsigned char *msg,
     }
 }
 
+static void timiditypp_synth_route(timiditypp_synth_object *sy, const unsigned char *msg, size_t size)
+{
+    size_t count = sy->parts.size();
+    unsigned status = (size > 0) ? msg[0] : 0;
+
+    // channel messages go to the player of the channel, others to all
+    if (status >= 0x80 && status < 0xf0)
+        timiditypp_synth_dispatch(*sy->parts[(status & 0x0f) % count].player, msg, size);
+    else {
+        for (size_t i = 0; i < count; ++i)
+            timiditypp_synth_dispatch(*sy->parts[i].player, msg, size);
+    }
+}
+
+struct timiditypp_render_job {
+    TimidityPlus::Player *player;
+    float *frames;
+    size_t nframes;
+};
+
+static void timiditypp_render_all(timiditypp_synth_object *sy, float *frames, size_t nframes)
+{
+    size_t count = sy->parts.size();
+
+    if (count == 1) {
+        sy->parts[0].player->compute_data(frames, nframes);
+        return;
+    }
+
+    // the first player renders to the output, the others get mixed into it
+    timiditypp_render_job data[timiditypp_max_players];
+    synth_job jobs[timiditypp_max_players];
+    float *mix = sy->mix_buffer.get();
+
+    while (nframes > 0) {
+        size_t segment = std::min<size_t>(nframes, timiditypp_mix_frames);
+
+        for (size_t i = 0; i < count; ++i) {
+            data[i].player = sy->parts[i].player.get();
+            data[i].frames = (i == 0) ? frames : (mix + 2 * timiditypp_mix_frames * (i - 1));
+            data[i].nframes = segment;
+            jobs[i].data = &data[i];
+            jobs[i].function = [](void *user_data) {
+                timiditypp_render_job *job = (timiditypp_render_job *)user_data;
+                job->player->compute_data(job->frames, job->nframes);
+            };
+        }
+
+        synth_run_jobs(timiditypp_plugin_host, jobs, count);
+
+        for (size_t i = 1; i < count; ++i)
+            synth_mix_add(frames, data[i].frames, 2 * segment);
+
+        frames += 2 * segment;
+        nframes -= segment;
+    }
+}
+
+static void timiditypp_synth_defer(timiditypp_synth_object *sy, const unsigned char *msg, size_t size)
+{
+    std::vector<unsigned char> &pending = sy->pending_events;
+
+    auto is_note_on = [](const unsigned char *msg, size_t size) -> bool {
+        return size >= 3 && (msg[0] & 0xf0) == 0x90 && msg[2] != 0;
+    };
+
+    // each message is stored after its size, in 2 bytes; when it does not
+    //   fit, the note-ons give their place to the others, which must not be
+    //   lost to avoid stuck notes, and nothing allocates on the audio thread
+    if (size <= 0xffff && pending.size() + 2 + size > pending.capacity() && !is_note_on(msg, size)) {
+        unsigned char *data = pending.data();
+        size_t kept = 0;
+        for (size_t i = 0, n = pending.size(); i + 2 <= n;) {
+            size_t length = 2 + (data[i] | (data[i + 1] << 8));
+            if (is_note_on(&data[i + 2], length - 2))
+                sy->pending_dropped.fetch_add(1, std::memory_order_relaxed);
+            else {
+                std::memmove(&data[kept], &data[i], length);
+                kept += length;
+            }
+            i += length;
+        }
+        pending.resize(kept);
+    }
+
+    if (size > 0xffff || pending.size() + 2 + size > pending.capacity()) {
+        sy->pending_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    pending.push_back((unsigned char)(size & 0xff));
+    pending.push_back((unsigned char)(size >> 8));
+    pending.insert(pending.end(), msg, msg + size);
+}
+
+static void timiditypp_synth_flush_deferred(timiditypp_synth_object *sy)
+{
+    std::vector<unsigned char> &pending = sy->pending_events;
+    const unsigned char *data = pending.data();
+
+    for (size_t i = 0, n = pending.size(); i + 2 <= n;) {
+        size_t size = data[i] | (data[i + 1] << 8);
+        timiditypp_synth_route(sy, &data[i + 2], size);
+        i += 2 + size;
+    }
+
+    pending.clear();
+}
+
+static void timiditypp_synth_write(synth_object *obj, const unsigned char *msg, size_t size)
+{
+    timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
+
+    std::unique_lock<std::mutex> lock(sy->mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+        timiditypp_synth_defer(sy, msg, size);
+    else {
+        timiditypp_synth_flush_deferred(sy);
+        timiditypp_synth_route(sy, msg, size);
+    }
+    sy->activity.trigger();
+}
+
 static void timiditypp_synth_generate(synth_object *obj, float *frames, size_t nframes)
 {
     timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
-    TimidityPlus::Player &player = *sy->player;
 
-    player.compute_data(frames, nframes);
+    std::unique_lock<std::mutex> lock(sy->mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+        std::fill_n(frames, 2 * nframes, 0.0f);
+    else {
+        timiditypp_synth_flush_deferred(sy);
+        timiditypp_render_all(sy, frames, nframes);
+    }
+    sy->activity.analyze(frames, nframes);
+}
+
+static void timiditypp_synth_process(synth_object *obj, float *frames, size_t nframes, const synth_event *events, size_t nevents)
+{
+    timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
+
+    // do not wait for the preload to finish with its instrument, it can
+    //   take longer than a cycle
+    std::unique_lock<std::mutex> lock(sy->mutex, std::try_to_lock);
+
+    if (!lock.owns_lock()) {
+        std::fill_n(frames, 2 * nframes, 0.0f);
+        for (size_t i = 0; i < nevents; ++i)
+            timiditypp_synth_defer(sy, events[i].data, events[i].size);
+    }
+    else {
+        timiditypp_synth_flush_deferred(sy);
+        synth_process_in_segments(
+            frames, nframes, events, nevents,
+            [sy](float *frames, size_t count) { timiditypp_render_all(sy, frames, count); },
+            [sy](const synth_event &ev) { timiditypp_synth_route(sy, ev.data, ev.size); });
+    }
+
+    if (nevents > 0)
+        sy->activity.trigger();
+    sy->activity.analyze(frames, nframes);
+}
+
+static int timiditypp_synth_active_voices(synth_object *obj)
+{
+    timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
+    return sy->activity.active() ? 1 : 0;
 }
 
 static void timiditypp_synth_set_option(synth_object *obj, const char *name, synth_value value)
@@ -212,26 +489,53 @@ static void timiditypp_synth_set_option(synth_object *obj, const char *name, syn
 
     if (!strcmp(name, "soundfont"))
         sy->soundfonts = string_list_dup(value.m);
+    else if (!strcmp(name, "parallel-players"))
+        sy->parallel_players = (int)std::max(1L, std::min((long)timiditypp_max_players, value.i));
 }
 
 static void timiditypp_synth_preload(synth_object *obj, const synth_midi_ins *ins, size_t count)
 {
     timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
-    TimidityPlus::Instruments *instruments = sy->instruments.get();
 
-    if (!instruments)
+    if (sy->parts.empty())
         return;
 
-    std::unique_ptr<uint16_t[]> ids(new uint16_t[count]);
-    size_t ids_count = 0;
+    timiditypp_stop_preload(sy);
+
+    std::vector<uint16_t> ids;
+    ids.reserve(count);
 
     for (size_t i = 0; i < count; ++i) {
         synth_midi_ins in = ins[i];
         uint16_t id = (bool(in.percussive) << 14) | ((in.bank_msb & 127) << 7) | (in.program & 127);
-        ids[ids_count++] = id;
+        ids.push_back(id);
     }
 
-    instruments->PrecacheInstruments(ids.get(), ids_count);
+    {
+        std::lock_guard<std::mutex> lock(sy->mutex);
+        sy->reader->prefetch();
+    }
+
+    // playback goes on meanwhile, instruments which are not loaded yet get
+    //   loaded on demand by the player
+    sy->preload_progress.store(0);
+    sy->preload_thread = std::thread([sy, ids]() {
+        size_t total = ids.size();
+        for (size_t i = 0; i < total && !sy->preload_cancel.load(); ++i) {
+            {
+                std::lock_guard<std::mutex> lock(sy->mutex);
+                sy->instruments->PrecacheInstruments(&ids[i], 1);
+            }
+            sy->preload_progress.store((int)((i + 1) * 100 / total));
+        }
+        sy->preload_progress.store(-1);
+    });
+}
+
+static int timiditypp_synth_preload_progress(synth_object *obj)
+{
+    timiditypp_synth_object *sy = (timiditypp_synth_object *)obj;
+    return sy->preload_progress.load();
 }
 
 static const synth_interface the_synth_interface = {
@@ -248,6 +552,14 @@ static const synth_interface the_synth_interface = {
     &timiditypp_synth_generate,
     &timiditypp_synth_set_option,
     &timiditypp_synth_preload,
+    &timiditypp_synth_process,
+    &timiditypp_plugin_set_host,
+    &timiditypp_synth_active_voices,
+    nullptr,
+    &timiditypp_synth_preload_progress,
+    nullptr,
+    nullptr,
+    nullptr,
 };
 
 extern "C" SYNTH_EXPORT const synth_interface *synth_plugin_entry()
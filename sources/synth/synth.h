@@ -18,7 +18,12 @@ extern "C" {
 #endif
 
 enum {
-    SYNTH_ABI_VERSION = 2
+    SYNTH_ABI_VERSION = 12
+};
+
+enum {
+    // the option can be changed while the synth is active
+    SYNTH_OPTION_LIVE = 1,
 };
 
 typedef struct _synth_object synth_object;
@@ -36,6 +41,8 @@ typedef struct _synth_option {
     const char *description;
     unsigned type;
     synth_value initial;
+    // ABI level 6
+    unsigned flags;
 } synth_option;
 
 typedef struct _synth_midi_ins {
@@ -45,6 +52,42 @@ typedef struct _synth_midi_ins {
     unsigned char bank_lsb : 7;
 } synth_midi_ins;
 
+typedef struct _synth_event {
+    // frame offset in the block, events are in nondecreasing order
+    unsigned frame;
+    // pre-decoded fields, with data bytes masked to 7 bits
+    unsigned char status;
+    unsigned char data1;
+    unsigned char data2;
+    // raw message, which includes the status byte
+    unsigned size;
+    const unsigned char *data;
+} synth_event;
+
+typedef struct _synth_job {
+    void (*function)(void *);
+    void *data;
+} synth_job;
+
+typedef struct _synth_host_interface {
+    void *context;
+    // number of threads which execute jobs, including the caller
+    unsigned (*worker_count)(void *);
+    // execute a batch of jobs, and return once they are all finished
+    void (*run_jobs)(void *, const synth_job *, size_t);
+    // ABI level 7
+    // map a file read-only, shared with other plugins, returns null on failure
+    const void *(*map_file)(void *, const char *, size_t *);
+    void (*unmap_file)(void *, const void *);
+    // advise that a range of a mapped file is about to be read
+    void (*prefetch_file)(void *, const void *, size_t);
+    // ABI level 9
+    // persistent values computed by the plugin, by section and key,
+    //   get returns the length of the value, or 0 if it does not exist
+    size_t (*cache_get)(void *, const char *, const char *, char *, size_t);
+    void (*cache_set)(void *, const char *, const char *, const char *);
+} synth_host_interface;
+
 typedef struct _synth_interface {
     unsigned abi_version;
     const char *name;
@@ -61,6 +104,32 @@ typedef struct _synth_interface {
     void (*synth_set_option)(synth_object *, const char *, synth_value);
     // ABI level 2
     void (*synth_preload)(synth_object *, const synth_midi_ins *, size_t);
+    // ABI level 3
+    void (*synth_process)(synth_object *, float *, size_t, const synth_event *, size_t);
+    // ABI level 4
+    void (*plugin_set_host)(const synth_host_interface *);
+    // ABI level 5
+    // count of sounding voices, 0 if output is silent until the next event
+    int (*synth_active_voices)(synth_object *);
+    // ABI level 8
+    // reduce the rendering cost when the CPU is short, from 1 (full quality)
+    //   down to 0 (lowest), called in the processing thread
+    void (*synth_set_quality)(synth_object *, double);
+    // ABI level 10
+    // percentage of completion of a preload which runs in the background,
+    //   or -1 if there is none in progress
+    int (*synth_preload_progress)(synth_object *);
+    // ABI level 11
+    // sample rate at which the emulation runs natively, or 0 for no preference,
+    //   which the host may use to instantiate, converting to its own rate
+    double (*plugin_preferred_rate)();
+    // ABI level 12
+    // before activation, have the MIDI channels rendered separately besides
+    //   the mix, returns 0 if supported
+    int (*synth_enable_channel_outputs)(synth_object *);
+    // process like synth_process, and also write each MIDI channel `c` to the
+    //   planar stereo pair `channels[2*c]`, `channels[2*c+1]`, unless null
+    void (*synth_process_channels)(synth_object *, float *, float *const *, size_t, const synth_event *, size_t);
 } synth_interface;
 
 typedef const synth_interface *(synth_plugin_entry_fn)();
@@ -0,0 +1,160 @@
+//          Copyright Jean Pierre Cimalando 2019-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "synth_files.h"
+#include "utility/logs.h"
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include "utility/charset.h"
+#include <windows.h>
+#endif
+#include <cstdint>
+
+Synth_File_Store::~Synth_File_Store()
+{
+    for (auto &item : by_path_)
+        unmap_mapping(item.second);
+}
+
+const void *Synth_File_Store::map(nonstd::string_view path, size_t *size)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string key(path);
+
+    auto it = by_path_.find(key);
+    if (it == by_path_.end()) {
+        Mapping mapping;
+        mapping.path = key;
+        if (!map_mapping(mapping)) {
+            Log::e("Cannot map file: %s", key.c_str());
+            return nullptr;
+        }
+        Log::i("Map file: %s (%lu bytes)", key.c_str(), (unsigned long)mapping.size);
+        it = by_path_.emplace(key, std::move(mapping)).first;
+        by_data_[it->second.data] = &it->second;
+    }
+
+    Mapping &mapping = it->second;
+    ++mapping.refs;
+    if (size)
+        *size = mapping.size;
+    return mapping.data;
+}
+
+void Synth_File_Store::unmap(const void *data)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = by_data_.find(data);
+    if (it == by_data_.end())
+        return;
+
+    Mapping &mapping = *it->second;
+    if (--mapping.refs > 0)
+        return;
+
+    Log::i("Unmap file: %s", mapping.path.c_str());
+    unmap_mapping(mapping);
+    std::string path = std::move(mapping.path);
+    by_data_.erase(it);
+    by_path_.erase(path);
+}
+
+void Synth_File_Store::prefetch(const void *data, size_t size)
+{
+#ifndef _WIN32
+    // the range must start on a page boundary
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)data & ~(page - 1);
+    uintptr_t end = (uintptr_t)data + size;
+    madvise((void *)start, end - start, MADV_WILLNEED);
+#else
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = (PVOID)data;
+    range.NumberOfBytes = size;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+}
+
+#ifndef _WIN32
+bool Synth_File_Store::map_mapping(Mapping &mapping)
+{
+    int fd = open(mapping.path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    mapping.data = data;
+    mapping.size = (size_t)st.st_size;
+    return true;
+}
+
+void Synth_File_Store::unmap_mapping(Mapping &mapping)
+{
+    if (mapping.data) {
+        munmap(mapping.data, mapping.size);
+        mapping.data = nullptr;
+    }
+}
+#else
+bool Synth_File_Store::map_mapping(Mapping &mapping)
+{
+    std::wstring wpath;
+    if (!convert_utf<char, wchar_t>(mapping.path, wpath, false))
+        return false;
+
+    HANDLE file = CreateFileW(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE handle = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!handle)
+        return false;
+
+    void *data = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(handle);
+        return false;
+    }
+
+    mapping.data = data;
+    mapping.size = (size_t)size.QuadPart;
+    mapping.handle = handle;
+    return true;
+}
+
+void Synth_File_Store::unmap_mapping(Mapping &mapping)
+{
+    if (mapping.data) {
+        UnmapViewOfFile(mapping.data);
+        mapping.data = nullptr;
+    }
+    if (mapping.handle) {
+        CloseHandle((HANDLE)mapping.handle);
+        mapping.handle = nullptr;
+    }
+}
+#endif
@@ -0,0 +1,46 @@
+//          Copyright Jean Pierre Cimalando 2019-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include <nonstd/string_view.hpp>
+#include <unordered_map>
+#include <string>
+#include <mutex>
+#include <cstddef>
+
+/**
+ * Read-only memory mappings of files, shared by all the synth plugins of the
+ * process, and counted by reference.
+ */
+class Synth_File_Store {
+public:
+    Synth_File_Store() = default;
+    ~Synth_File_Store();
+
+    const void *map(nonstd::string_view path, size_t *size);
+    void unmap(const void *data);
+    static void prefetch(const void *data, size_t size);
+
+private:
+    Synth_File_Store(const Synth_File_Store &) = delete;
+    Synth_File_Store &operator=(const Synth_File_Store &) = delete;
+
+private:
+    struct Mapping {
+        std::string path;
+        void *data = nullptr;
+        size_t size = 0;
+        void *handle = nullptr;
+        unsigned refs = 0;
+    };
+
+    static bool map_mapping(Mapping &mapping);
+    static void unmap_mapping(Mapping &mapping);
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, Mapping> by_path_;
+    std::unordered_map<const void *, Mapping *> by_data_;
+};
@@ -5,19 +5,28 @@
 
 #include "synth_host.h"
 #include "synth_utility.h"
+#include "synth_workers.h"
+#include "synth_files.h"
+#include "audio/resampler.h"
 #include "configuration.h"
 #include "utility/paths.h"
 #include "utility/module.h"
 #include "utility/charset.h"
 #include "utility/logs.h"
+#include <ring_buffer.h>
 #include <nonstd/scope.hpp>
 #include <algorithm>
+#include <mutex>
 #include <cassert>
+#include <cstring>
+#include <cstdlib>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 static const nonstd::string_view plugin_prefix = "s_";
+static const char plugin_cache_name[] = "plugin-cache";
+static const char synth_cache_name[] = "synth-cache";
 #if defined(_WIN32)
 static const nonstd::string_view plugin_suffix = ".dll";
 #elif defined(__APPLE__)
@@ -26,13 +35,25 @@ static const nonstd::string_view plugin_suffix = ".dylib";
 static const nonstd::string_view plugin_suffix = ".so";
 #endif
 
+static constexpr unsigned live_option_max = 64;
+
+struct Synth_Host::Live_Option {
+    size_t index;
+    synth_value value;
+};
+
+// the resampled output is produced in blocks of this size at most
+static constexpr size_t resampler_block_frames = 1024;
+
 Synth_Host::Synth_Host()
+    : live_options_(new Ring_Buffer(live_option_max * sizeof(Live_Option)))
 {
 }
 
 Synth_Host::~Synth_Host()
 {
     unload();
+    shutdown_module();
 }
 
 const std::string &Synth_Host::plugin_dir()
@@ -47,6 +68,98 @@ const std::vector<Synth_Host::Plugin_Info> &Synth_Host::plugins()
     return plugins;
 }
 
+Synth_Worker_Pool &Synth_Host::worker_pool()
+{
+    static Synth_Worker_Pool pool(Synth_Worker_Pool::default_thread_count());
+    return pool;
+}
+
+Synth_File_Store &Synth_Host::file_store()
+{
+    static Synth_File_Store store;
+    return store;
+}
+
+// values which the plugins keep from a run to the next; they are written
+//   at once after the plugin code is done setting them
+static std::mutex synth_cache_mutex;
+static std::unique_ptr<CSimpleIniA> synth_cache;
+static bool synth_cache_dirty = false;
+
+static CSimpleIniA &get_synth_cache()
+{
+    if (!synth_cache) {
+        synth_cache = load_configuration(synth_cache_name);
+        if (!synth_cache) synth_cache = create_configuration();
+    }
+    return *synth_cache;
+}
+
+static size_t synth_cache_get(const char *section, const char *key, char *buffer, size_t size)
+{
+    std::lock_guard<std::mutex> lock(synth_cache_mutex);
+    const char *value = get_synth_cache().GetValue(section, key);
+    if (!value)
+        return 0;
+
+    size_t length = std::strlen(value);
+    if (size > 0) {
+        size_t count = std::min(length, size - 1);
+        std::memcpy(buffer, value, count);
+        buffer[count] = '\0';
+    }
+    return length;
+}
+
+static void synth_cache_set(const char *section, const char *key, const char *value)
+{
+    std::lock_guard<std::mutex> lock(synth_cache_mutex);
+    get_synth_cache().SetValue(section, key, value);
+    synth_cache_dirty = true;
+}
+
+static void synth_cache_flush()
+{
+    std::lock_guard<std::mutex> lock(synth_cache_mutex);
+    if (synth_cache_dirty) {
+        save_configuration(synth_cache_name, *synth_cache);
+        synth_cache_dirty = false;
+    }
+}
+
+static synth_host_interface make_host_interface()
+{
+    synth_host_interface intf {};
+    intf.worker_count = +[](void *) -> unsigned {
+        return Synth_Host::worker_pool().worker_count();
+    };
+    intf.run_jobs = +[](void *, const synth_job *jobs, size_t count) {
+        Synth_Host::worker_pool().run_jobs(jobs, count);
+    };
+    intf.map_file = +[](void *, const char *path, size_t *size) -> const void * {
+        return Synth_Host::file_store().map(path, size);
+    };
+    intf.unmap_file = +[](void *, const void *data) {
+        Synth_Host::file_store().unmap(data);
+    };
+    intf.prefetch_file = +[](void *, const void *data, size_t size) {
+        Synth_File_Store::prefetch(data, size);
+    };
+    intf.cache_get = +[](void *, const char *section, const char *key, char *buffer, size_t size) -> size_t {
+        return synth_cache_get(section, key, buffer, size);
+    };
+    intf.cache_set = +[](void *, const char *section, const char *key, const char *value) {
+        synth_cache_set(section, key, value);
+    };
+    return intf;
+}
+
+const synth_host_interface &Synth_Host::host_interface()
+{
+    static const synth_host_interface intf = make_host_interface();
+    return intf;
+}
+
 bool Synth_Host::load(nonstd::string_view id, double srate)
 {
     const std::vector<Plugin_Info> &plugin_list = plugins();
@@ -85,11 +198,27 @@ bool Synth_Host::load(nonstd::string_view id, double srate)
 
     unload();
 
-    intf->plugin_init(get_configuration_dir().c_str());
+    auto cache_flush = nonstd::make_scope_exit([] { synth_cache_flush(); });
+
+    // the module stays initialized across the reloads of its synth, so it
+    //   keeps what it caches at the plugin level, such as mapped files
+    if (intf != intf_) {
+        shutdown_module();
+        intf->plugin_init(get_configuration_dir().c_str());
+        if (intf->abi_version >= 4 && intf->plugin_set_host)
+            intf->plugin_set_host(&host_interface());
+    }
+
     module_ = handle;
     intf_ = intf;
+    info_ = info;
+
+    std::unique_ptr<CSimpleIniA> global_ini = load_global_configuration();
+    if (!global_ini)
+        global_ini.reset(new CSimpleIniA);
 
-    synth_object *synth = intf->synth_instantiate(srate);
+    const double synth_rate = render_rate(*intf, srate, *global_ini);
+    synth_object *synth = intf->synth_instantiate(synth_rate);
     if (!synth)
         return false;
 
@@ -99,14 +228,59 @@ bool Synth_Host::load(nonstd::string_view id, double srate)
 
     initial_setup_synth(*info, intf, synth);
 
+    // the separate channels are not resampled, they are only at the device rate
+    channel_outputs_ = false;
+    if (global_ini->GetBoolValue("", "synth-channel-outputs", false)) {
+        if (synth_rate == srate && intf->abi_version >= 12 &&
+            intf->synth_enable_channel_outputs && intf->synth_process_channels)
+            channel_outputs_ = intf->synth_enable_channel_outputs(synth) == 0;
+        if (!channel_outputs_)
+            Log::w("Synth cannot render the channels to separate outputs");
+    }
+
     if (intf->synth_activate(synth) == -1)
         return false;
 
+    if (synth_rate != srate) {
+        nonstd::string_view quality_name = global_ini->GetValue("", "synth-resampler-quality", "medium");
+        resampler_polyphase::quality quality = resampler_polyphase::medium;
+        if (quality_name == "fast")
+            quality = resampler_polyphase::fast;
+        else if (quality_name == "best")
+            quality = resampler_polyphase::best;
+
+        resampler_polyphase *rs = new resampler_polyphase;
+        resampler_.reset(rs);
+        rs->init(synth_rate, srate, quality, resampler_block_frames);
+        render_buffer_.reset(new float[2 * rs->max_input_frames()]);
+        render_events_.reserve(1024);
+        render_ratio_ = synth_rate / srate;
+        Log::i("Synth renders at %g Hz, resampled to %g Hz", synth_rate, srate);
+    }
+
     synth_ = synth;
     synth_success = true;
     return true;
 }
 
+double Synth_Host::render_rate(const synth_interface &intf, double srate, const CSimpleIniA &ini)
+{
+    nonstd::string_view mode = ini.GetValue("", "synth-render-rate", "device");
+
+    double rate = 0;
+    if (mode == "native") {
+        if (intf.abi_version >= 11 && intf.plugin_preferred_rate)
+            rate = intf.plugin_preferred_rate();
+    }
+    else if (mode != "device") {
+        // a fixed rate, only to render below the rate of the device
+        rate = std::strtod(std::string(mode).c_str(), nullptr);
+        rate = (rate > 0) ? std::max(8000.0, std::min(srate, rate)) : 0;
+    }
+
+    return (rate > 0) ? rate : srate;
+}
+
 void Synth_Host::unload()
 {
     synth_object *synth = synth_;
@@ -118,12 +292,96 @@ void Synth_Host::unload()
         synth_ = nullptr;
     }
 
+    option_text_.clear();
+
+    preload_progress_.store(-1, std::memory_order_relaxed);
+    resampler_.reset();
+    render_buffer_.reset();
+    render_ratio_ = 1;
+    channel_outputs_ = false;
+
+    // the consumer is not running while the synth is being unloaded
+    Ring_Buffer &live_options = *live_options_;
+    live_options.discard(live_options.size_used());
+}
+
+void Synth_Host::shutdown_module()
+{
+    const synth_interface *intf = intf_;
+
     if (intf) {
         intf->plugin_shutdown();
         intf_ = nullptr;
+        synth_cache_flush();
     }
 
     module_ = nullptr;
+    info_ = nullptr;
+}
+
+bool Synth_Host::reload_options()
+{
+    synth_object *synth = synth_;
+    const synth_interface *intf = intf_;
+    const Plugin_Info *info = info_;
+
+    if (!synth)
+        return true;
+
+    assert(intf && info);
+    std::unique_ptr<CSimpleIniA> ini = load_configuration("s_" + info->id);
+    if (!ini)
+        return true;
+
+    Ring_Buffer &live_options = *live_options_;
+    bool need_reload = false;
+
+    const synth_option *opt;
+    for (size_t i = 0; (opt = intf->plugin_option(i)) && i < option_text_.size(); ++i) {
+        std::string text = option_text(*ini, *opt);
+        if (text == option_text_[i])
+            continue;
+
+        bool live = intf->abi_version >= 6 && (opt->flags & SYNTH_OPTION_LIVE) &&
+            (opt->type == 'i' || opt->type == 'f' || opt->type == 'b');
+        if (!live) {
+            Log::i("Option requires to reload the synth: %s", opt->name);
+            need_reload = true;
+            continue;
+        }
+
+        Live_Option lo;
+        lo.index = i;
+        lo.value = {};
+        std::unique_ptr<const char *[]> mval;
+        if (!read_option(*ini, *opt, lo.value, mval))
+            lo.value = opt->initial;
+
+        if (!live_options.put(lo)) {
+            Log::w("Too many option changes, reload the synth");
+            need_reload = true;
+            continue;
+        }
+
+        Log::i("Change option live: %s", opt->name);
+        option_text_[i] = std::move(text);
+    }
+
+    return !need_reload;
+}
+
+void Synth_Host::apply_live_options()
+{
+    synth_object *synth = synth_;
+    const synth_interface *intf = intf_;
+    Ring_Buffer &live_options = *live_options_;
+
+    Live_Option lo;
+    while (live_options.get(lo)) {
+        const synth_option *opt = intf->plugin_option(lo.index);
+        if (opt)
+            intf->synth_set_option(synth, opt->name, lo.value);
+    }
 }
 
 void Synth_Host::generate(float *buffer, size_t nframes)
@@ -137,7 +395,11 @@ void Synth_Host::generate(float *buffer, size_t nframes)
     }
 
     assert(intf);
-    intf->synth_generate(synth, buffer, nframes);
+    apply_live_options();
+    if (resampler_)
+        render_resampled(buffer, nframes, {});
+    else
+        intf->synth_generate(synth, buffer, nframes);
 }
 
 void Synth_Host::send_midi(const uint8_t *data, unsigned len)
@@ -152,6 +414,96 @@ void Synth_Host::send_midi(const uint8_t *data, unsigned len)
     intf->synth_write(synth, data, len);
 }
 
+bool Synth_Host::process(float *buffer, size_t nframes, nonstd::span<const synth_event> events, float *const *channels)
+{
+    synth_object *synth = synth_;
+    const synth_interface *intf = intf_;
+
+    if (!synth) {
+        std::fill(buffer, buffer + 2 * nframes, 0);
+        clear_channel_outputs(channels, nframes);
+        return false;
+    }
+
+    assert(intf);
+    apply_live_options();
+    update_preload_progress();
+
+    if (events.empty() && intf->abi_version >= 5 && intf->synth_active_voices &&
+        intf->synth_active_voices(synth) == 0)
+    {
+        std::fill(buffer, buffer + 2 * nframes, 0);
+        clear_channel_outputs(channels, nframes);
+        return false;
+    }
+
+    if (channels && channel_outputs_) {
+        intf->synth_process_channels(synth, buffer, channels, nframes, events.data(), events.size());
+        return true;
+    }
+
+    if (resampler_)
+        render_resampled(buffer, nframes, events);
+    else
+        render(buffer, nframes, events);
+    clear_channel_outputs(channels, nframes);
+    return true;
+}
+
+void Synth_Host::clear_channel_outputs(float *const *channels, size_t nframes)
+{
+    if (!channels)
+        return;
+
+    for (unsigned i = 0; i < 2 * synth_channel_count; ++i) {
+        if (float *channel = channels[i])
+            std::fill(channel, channel + nframes, 0);
+    }
+}
+
+void Synth_Host::render(float *buffer, size_t nframes, nonstd::span<const synth_event> events)
+{
+    synth_object *synth = synth_;
+    const synth_interface *intf = intf_;
+
+    if (intf->abi_version >= 3 && intf->synth_process) {
+        intf->synth_process(synth, buffer, nframes, events.data(), events.size());
+        return;
+    }
+
+    synth_process_in_segments(
+        buffer, nframes, events.data(), events.size(),
+        [intf, synth](float *frames, size_t count) { intf->synth_generate(synth, frames, count); },
+        [intf, synth](const synth_event &ev) { intf->synth_write(synth, ev.data, ev.size); });
+}
+
+void Synth_Host::render_resampled(float *buffer, size_t nframes, nonstd::span<const synth_event> events)
+{
+    resampler_polyphase &rs = *resampler_;
+    float *render_buffer = render_buffer_.get();
+    std::vector<synth_event> &render_events = render_events_;
+
+    for (size_t index = 0; index < nframes;) {
+        size_t count = std::min<size_t>(resampler_block_frames, nframes - index);
+        size_t input_count = rs.input_frames_for(count);
+        bool last = index + count == nframes;
+
+        // the events of this block, placed on the timeline of the synth
+        render_events.clear();
+        for (const synth_event &ev : events) {
+            if (ev.frame < index || (ev.frame >= index + count && !last))
+                continue;
+            synth_event rev = ev;
+            rev.frame = (unsigned)std::min<size_t>(input_count, (size_t)((ev.frame - index) * render_ratio_));
+            render_events.push_back(rev);
+        }
+
+        render(render_buffer, input_count, render_events);
+        rs.process(render_buffer, input_count, buffer + 2 * index, count);
+        index += count;
+    }
+}
+
 bool Synth_Host::can_preload() const
 {
     synth_object *synth = synth_;
@@ -177,6 +529,41 @@ void Synth_Host::preload(nonstd::span<const synth_midi_ins> instruments)
         return;
 
     intf->synth_preload(synth, instruments.data(), instruments.size());
+    update_preload_progress();
+}
+
+void Synth_Host::update_preload_progress()
+{
+    synth_object *synth = synth_;
+    const synth_interface *intf = intf_;
+
+    int progress = -1;
+    if (synth && intf->abi_version >= 10 && intf->synth_preload_progress)
+        progress = intf->synth_preload_progress(synth);
+    preload_progress_.store(progress, std::memory_order_relaxed);
+}
+
+bool Synth_Host::can_set_quality() const
+{
+    synth_object *synth = synth_;
+    const synth_interface *intf = intf_;
+
+    if (!synth)
+        return false;
+
+    assert(intf);
+    return intf->abi_version >= 8 && intf->synth_set_quality;
+}
+
+void Synth_Host::set_quality(double quality)
+{
+    synth_object *synth = synth_;
+    const synth_interface *intf = intf_;
+
+    if (!can_set_quality())
+        return;
+
+    intf->synth_set_quality(synth, quality);
 }
 
 std::string Synth_Host::find_plugin_dir()
@@ -214,6 +601,12 @@ std::vector<Synth_Host::Plugin_Info> Synth_Host::do_plugin_scan()
     if (!dh)
         return plugins;
 
+    // manifest of the plugins which were scanned, keyed by path
+    std::unique_ptr<CSimpleIniA> cache = load_configuration(plugin_cache_name);
+    if (!cache) cache = create_configuration();
+    bool cache_update = false;
+    std::vector<std::string> cache_sections;
+
     for (std::string name; dh.read_next(name);) {
         size_t namelen = name.size();
 
@@ -225,7 +618,33 @@ std::vector<Synth_Host::Plugin_Info> Synth_Host::do_plugin_scan()
             nonstd::string_view(name).substr(namelen - suffixlen) == plugin_suffix)
         {
             nonstd::string_view id = nonstd::string_view(name).substr(prefixlen, namelen - prefixlen - suffixlen);
-            Dl_Handle_U handle(Dl_open((dir + name.data()).c_str()));
+            std::string path = dir + name;
+
+            long long size = 0;
+            long long mtime = 0;
+            if (!filestat_utf8(path.c_str(), &size, &mtime))
+                continue;
+
+            const char *section = path.c_str();
+            cache_sections.push_back(path);
+
+            const char *cached_name = cache->GetValue(section, "name");
+            bool cache_valid = cached_name &&
+                cache->GetLongValue(section, "abi", 0) <= SYNTH_ABI_VERSION &&
+                std::to_string(size) == cache->GetValue(section, "size", "") &&
+                std::to_string(mtime) == cache->GetValue(section, "mtime", "") &&
+                filemode_utf8(get_configuration_file("s_" + std::string(id)).c_str()) != -1;
+
+            if (cache_valid) {
+                Log::s("Synth plugin found: %s (cached)", cached_name);
+                Plugin_Info info;
+                info.id = std::string(id.data(), id.size());
+                info.name = cached_name;
+                plugins.emplace_back(std::move(info));
+                continue;
+            }
+
+            Dl_Handle_U handle(Dl_open(path.c_str()));
             synth_plugin_entry_fn *entry = nullptr;
             const synth_interface *intf = nullptr;
             if (handle)
@@ -240,10 +659,31 @@ std::vector<Synth_Host::Plugin_Info> Synth_Host::do_plugin_scan()
                 info.name = intf->name;
                 initial_setup_plugin(info, *intf);
                 plugins.emplace_back(std::move(info));
+
+                cache->Delete(section, nullptr);
+                cache->SetValue(section, "name", intf->name);
+                cache->SetLongValue(section, "abi", (long)intf->abi_version);
+                cache->SetValue(section, "size", std::to_string(size).c_str());
+                cache->SetValue(section, "mtime", std::to_string(mtime).c_str());
+                cache_update = true;
             }
         }
     }
 
+    // forget the plugins which were removed
+    CSimpleIniA::TNamesDepend sections;
+    cache->GetAllSections(sections);
+    for (const CSimpleIniA::Entry &ent : sections) {
+        if (std::find(cache_sections.begin(), cache_sections.end(), ent.pItem) == cache_sections.end()) {
+            cache->Delete(ent.pItem, nullptr);
+            cache_update = true;
+        }
+    }
+
+    if (cache_update)
+        save_configuration(plugin_cache_name, *cache);
+    synth_cache_flush();
+
     std::sort(
         plugins.begin(), plugins.end(),
         [](const Plugin_Info &a, const Plugin_Info &b) -> bool { return a.name < b.name; });
@@ -315,63 +755,81 @@ void Synth_Host::initial_setup_synth(const Plugin_Info &info, const synth_interf
 {
     std::unique_ptr<CSimpleIniA> ini = load_configuration("s_" + info.id);
 
-    if (!ini) {
-        const synth_option *opt;
-        for (size_t i = 0; (opt = intf->plugin_option(i)); ++i)
-            intf->synth_set_option(synth, opt->name, opt->initial);
-        return;
-    }
+    option_text_.clear();
 
     const synth_option *opt;
     for (size_t i = 0; (opt = intf->plugin_option(i)); ++i) {
         synth_value value = {};
-        bool valid = false;
-
         std::unique_ptr<const char *[]> mval;
+        bool valid = ini && read_option(*ini, *opt, value, mval);
 
-        switch (opt->type) {
-        case 'i':
-            if (const char *inival = ini->GetValue("", opt->name)) {
-                unsigned count = 0;
-                valid = sscanf(inival, "%ld%n", &value.i, &count) == 1 && count == strlen(inival);
-            }
-            break;
-        case 'f':
-            if (const char *inival = ini->GetValue("", opt->name)) {
-                unsigned count = 0;
-                valid = sscanf(inival, "%lf%n", &value.f, &count) == 1 && count == strlen(inival);
-            }
-            break;
-        case 'b':
-            if (const char *inival = ini->GetValue("", opt->name)) {
-                value.b = !strcmp(inival, "true");
-                valid = value.b || !strcmp(inival, "false");
-            }
-            break;
-        case 's':
-            if (const char *inival = ini->GetValue("", opt->name)) {
-                value.s = inival;
-                valid = true;
-            }
-            break;
-        case 'm': {
-            CSimpleIniA::TNamesDepend values;
-            if (ini->GetAllValues("", opt->name, values)) {
-                values.sort(CSimpleIniA::Entry::LoadOrder());
-                mval.reset(new const char *[values.size() + 1]);
-                const char **p = mval.get();
-                for (const CSimpleIniA::Entry &ent : values)
-                    *p++ = ent.pItem;
-                *p++ = nullptr;
-                value.m = mval.get();
-                valid = true;
-            }
-            break;
+        intf->synth_set_option(synth, opt->name, valid ? value : opt->initial);
+        option_text_.push_back(ini ? option_text(*ini, *opt) : std::string());
+    }
+}
+
+bool Synth_Host::read_option(const CSimpleIniA &ini, const synth_option &opt, synth_value &value, std::unique_ptr<const char *[]> &mval)
+{
+    bool valid = false;
+
+    switch (opt.type) {
+    case 'i':
+        if (const char *inival = ini.GetValue("", opt.name)) {
+            unsigned count = 0;
+            valid = sscanf(inival, "%ld%n", &value.i, &count) == 1 && count == strlen(inival);
         }
-        default:
-            assert(false);
+        break;
+    case 'f':
+        if (const char *inival = ini.GetValue("", opt.name)) {
+            unsigned count = 0;
+            valid = sscanf(inival, "%lf%n", &value.f, &count) == 1 && count == strlen(inival);
+        }
+        break;
+    case 'b':
+        if (const char *inival = ini.GetValue("", opt.name)) {
+            value.b = !strcmp(inival, "true");
+            valid = value.b || !strcmp(inival, "false");
+        }
+        break;
+    case 's':
+        if (const char *inival = ini.GetValue("", opt.name)) {
+            value.s = inival;
+            valid = true;
         }
+        break;
+    case 'm': {
+        CSimpleIniA::TNamesDepend values;
+        if (ini.GetAllValues("", opt.name, values)) {
+            values.sort(CSimpleIniA::Entry::LoadOrder());
+            mval.reset(new const char *[values.size() + 1]);
+            const char **p = mval.get();
+            for (const CSimpleIniA::Entry &ent : values)
+                *p++ = ent.pItem;
+            *p++ = nullptr;
+            value.m = mval.get();
+            valid = true;
+        }
+        break;
+    }
+    default:
+        assert(false);
+    }
 
-        intf->synth_set_option(synth, opt->name, valid ? value : opt->initial);
+    return valid;
+}
+
+std::string Synth_Host::option_text(const CSimpleIniA &ini, const synth_option &opt)
+{
+    std::string text;
+
+    CSimpleIniA::TNamesDepend values;
+    if (ini.GetAllValues("", opt.name, values)) {
+        values.sort(CSimpleIniA::Entry::LoadOrder());
+        for (const CSimpleIniA::Entry &ent : values) {
+            text.append(ent.pItem);
+            text.push_back('\n');
+        }
     }
+
+    return text;
 }
@@ -6,12 +6,20 @@
 #pragma once
 #include "synth.h"
 #include "utility/load_library.h"
+class Synth_Worker_Pool;
+class Synth_File_Store;
+class resampler_polyphase;
+template <bool> class Ring_Buffer_Ex;
+typedef Ring_Buffer_Ex<true> Ring_Buffer;
 #include <SimpleIni.h>
 #include <nonstd/span.hpp>
 #include <nonstd/string_view.hpp>
 #include <string>
 #include <vector>
 #include <memory>
+#include <atomic>
+
+enum { synth_channel_count = 16 };
 
 class Synth_Host {
 public:
@@ -32,19 +40,62 @@ public:
 
     static const std::string &plugin_dir();
     static const std::vector<Plugin_Info> &plugins();
+    static Synth_Worker_Pool &worker_pool();
+    static Synth_File_Store &file_store();
+    static const synth_host_interface &host_interface();
 
     bool load(nonstd::string_view id, double srate);
     void unload();
     void generate(float *buffer, size_t nframes);
     void send_midi(const uint8_t *data, unsigned len);
+    // returns false if the output is known to be silent
+    //   channels: optional planar stereo pairs for the MIDI channels, which
+    //   are rendered separately if the synth is able, otherwise silent
+    bool process(float *buffer, size_t nframes, nonstd::span<const synth_event> events, float *const *channels = nullptr);
     bool can_preload() const;
     void preload(nonstd::span<const synth_midi_ins> instruments);
+    // can be called from any thread, without locking
+    int preload_progress() const { return preload_progress_.load(std::memory_order_relaxed); }
+    bool can_set_quality() const;
+    void set_quality(double quality);
+    // apply the options which have changed in the configuration,
+    //   returns false if some of them require to reload the synth
+    bool reload_options();
 
 private:
     Dl_Handle module_;
     std::map<std::string, Dl_Handle_U> loaded_modules_;
     const synth_interface *intf_ = nullptr;
     synth_object *synth_ = nullptr;
+    const Plugin_Info *info_ = nullptr;
+
+    // configuration text of the options, as applied to the synth
+    std::vector<std::string> option_text_;
+
+    // option changes, from the control thread to the processing thread
+    struct Live_Option;
+    std::unique_ptr<Ring_Buffer> live_options_;
+
+    // conversion from the rate of the synth to the rate of the host
+    std::unique_ptr<resampler_polyphase> resampler_;
+    std::unique_ptr<float[]> render_buffer_;
+    std::vector<synth_event> render_events_;
+    double render_ratio_ = 1;
+
+    // progress of the background preload, as last read from the synth
+    std::atomic<int> preload_progress_{-1};
+
+    // whether the synth renders the MIDI channels separately on request
+    bool channel_outputs_ = false;
+
+private:
+    void shutdown_module();
+    void apply_live_options();
+    void update_preload_progress();
+    void render(float *buffer, size_t nframes, nonstd::span<const synth_event> events);
+    void render_resampled(float *buffer, size_t nframes, nonstd::span<const synth_event> events);
+    static double render_rate(const synth_interface &intf, double srate, const CSimpleIniA &ini);
+    static void clear_channel_outputs(float *const *channels, size_t nframes);
 
 private:
     static std::string plugin_path(const Plugin_Info &info);
@@ -53,5 +104,7 @@ private:
     static std::string find_plugin_dir();
     static std::vector<Plugin_Info> do_plugin_scan();
     static void initial_setup_plugin(const Plugin_Info &info, const synth_interface &intf);
-    static void initial_setup_synth(const Plugin_Info &info, const synth_interface *intf, synth_object *synth);
+    void initial_setup_synth(const Plugin_Info &info, const synth_interface *intf, synth_object *synth);
+    static bool read_option(const CSimpleIniA &ini, const synth_option &opt, synth_value &value, std::unique_ptr<const char *[]> &mval);
+    static std::string option_text(const CSimpleIniA &ini, const synth_option &opt);
 };
@@ -5,6 +5,9 @@
 
 #include "synth_utility.h"
 #include <cstring>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 void string_list_delete::operator()(char **p) const
 {
@@ -26,3 +29,79 @@ string_list_ptr string_list_dup(const char *const *list)
     copy[n] = nullptr;
     return copy;
 }
+
+void synth_mix_add(float *dst, const float *src, size_t count)
+{
+    size_t i = 0;
+#if defined(__SSE__)
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(&dst[i], _mm_add_ps(_mm_loadu_ps(&dst[i]), _mm_loadu_ps(&src[i])));
+#endif
+    for (; i < count; ++i)
+        dst[i] += src[i];
+}
+
+void synth_mix_add_scaled(float *dst, const float *src, size_t count, float gain)
+{
+    size_t i = 0;
+#if defined(__SSE__)
+    __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(&dst[i], _mm_mul_ps(g, _mm_add_ps(_mm_loadu_ps(&dst[i]), _mm_loadu_ps(&src[i]))));
+#endif
+    for (; i < count; ++i)
+        dst[i] = gain * (dst[i] + src[i]);
+}
+
+bool synth_cache_get(const synth_host_interface *host, const char *section, const char *key, std::string &value)
+{
+    if (!host)
+        return false;
+
+    char buffer[256];
+    size_t length = host->cache_get(host->context, section, key, buffer, sizeof(buffer));
+    if (length == 0)
+        return false;
+
+    if (length < sizeof(buffer))
+        value.assign(buffer, length);
+    else {
+        value.resize(length + 1);
+        host->cache_get(host->context, section, key, &value[0], length + 1);
+        value.resize(length);
+    }
+    return true;
+}
+
+void synth_cache_set(const synth_host_interface *host, const char *section, const char *key, const char *value)
+{
+    if (host)
+        host->cache_set(host->context, section, key, value);
+}
+
+const void *synth_file_cache::map(const synth_host_interface *host, const std::string &path, size_t *size)
+{
+    if (!host || !host->map_file)
+        return nullptr;
+
+    auto it = files_.find(path);
+    if (it == files_.end()) {
+        size_t length = 0;
+        const void *data = host->map_file(host->context, path.c_str(), &length);
+        if (!data)
+            return nullptr;
+        it = files_.emplace(path, std::make_pair(data, length)).first;
+    }
+
+    *size = it->second.second;
+    return it->second.first;
+}
+
+void synth_file_cache::clear(const synth_host_interface *host)
+{
+    if (host) {
+        for (const auto &item : files_)
+            host->unmap_file(host->context, item.second.first);
+    }
+    files_.clear();
+}
@@ -4,9 +4,129 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 #pragma once
+#include "synth.h"
+#include <unordered_map>
+#include <string>
 #include <memory>
 
 struct string_list_delete { void operator()(char **p) const; };
 typedef std::unique_ptr<char *[], string_list_delete> string_list_ptr;
 
 string_list_ptr string_list_dup(const char *const *list);
+
+///
+inline synth_event synth_event_decode(const unsigned char *msg, size_t size, unsigned frame = 0)
+{
+    synth_event ev;
+    ev.frame = frame;
+    ev.status = (size > 0) ? msg[0] : 0;
+    ev.data1 = (size > 1) ? (msg[1] & 127) : 0;
+    ev.data2 = (size > 2) ? (msg[2] & 127) : 0;
+    ev.size = (unsigned)size;
+    ev.data = msg;
+    return ev;
+}
+
+/**
+ * Render a block in segments delimited by the frame offsets of the events,
+ * dispatching each event at the start of its segment.
+ */
+template <class Render, class Dispatch>
+void synth_process_in_segments(
+    float *frames, size_t nframes, const synth_event *events, size_t nevents,
+    Render &&render, Dispatch &&dispatch)
+{
+    size_t index = 0;
+
+    for (size_t i = 0; i < nevents; ++i) {
+        const synth_event &ev = events[i];
+        size_t frame = (ev.frame < nframes) ? ev.frame : nframes;
+        if (frame > index) {
+            render(frames + 2 * index, frame - index);
+            index = frame;
+        }
+        dispatch(ev);
+    }
+
+    if (index < nframes)
+        render(frames + 2 * index, nframes - index);
+}
+
+/**
+ * Detect silence in the output of a synth which is not able to report its
+ * activity by itself.
+ */
+class synth_activity_monitor {
+public:
+    void init(double srate, double hold_time = 0.5)
+    {
+        hold_frames_ = (size_t)(hold_time * srate);
+        trigger();
+    }
+
+    void trigger()
+    {
+        silent_frames_ = 0;
+    }
+
+    void analyze(const float *frames, size_t nframes)
+    {
+        const float threshold = 1e-5f;
+        float peak = 0;
+        for (size_t i = 0; i < 2 * nframes; ++i) {
+            float mag = (frames[i] < 0) ? -frames[i] : frames[i];
+            peak = (mag > peak) ? mag : peak;
+        }
+        silent_frames_ = (peak > threshold) ? 0 : (silent_frames_ + nframes);
+    }
+
+    bool active() const
+    {
+        return silent_frames_ < hold_frames_;
+    }
+
+private:
+    size_t hold_frames_ = 0;
+    size_t silent_frames_ = 0;
+};
+
+/**
+ * Mix a buffer of samples into another: `dst += src`, or with a gain applied
+ * to the sum: `dst = gain * (dst + src)`.
+ */
+void synth_mix_add(float *dst, const float *src, size_t count);
+void synth_mix_add_scaled(float *dst, const float *src, size_t count, float gain);
+
+/**
+ * Execute a batch of jobs on the host workers, or inline if the host does not
+ * provide any.
+ */
+inline void synth_run_jobs(const synth_host_interface *host, const synth_job *jobs, size_t count)
+{
+    if (host)
+        host->run_jobs(host->context, jobs, count);
+    else {
+        for (size_t i = 0; i < count; ++i)
+            jobs[i].function(jobs[i].data);
+    }
+}
+
+/**
+ * Access the values which the host keeps for the plugin between runs.
+ * Without a host, nothing is stored.
+ */
+bool synth_cache_get(const synth_host_interface *host, const char *section, const char *key, std::string &value);
+void synth_cache_set(const synth_host_interface *host, const char *section, const char *key, const char *value);
+
+/**
+ * Files which the plugin maps through the host, kept mapped for reuse until
+ * the cache is cleared.
+ */
+class synth_file_cache {
+public:
+    const void *map(const synth_host_interface *host, const std::string &path, size_t *size);
+    void clear(const synth_host_interface *host);
+
+private:
+    std::unordered_map<std::string, std::pair<const void *, size_t>> files_;
+};
@@ -0,0 +1,113 @@
+//          Copyright Jean Pierre Cimalando 2019-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "synth_workers.h"
+#include "utility/thread_priority.h"
+#include "utility/logs.h"
+#include <algorithm>
+
+static constexpr unsigned max_worker_threads = 7;
+
+Synth_Worker_Pool::Synth_Worker_Pool(unsigned thread_count)
+{
+    threads_.reserve(thread_count);
+    for (unsigned i = 0; i < thread_count; ++i)
+        threads_.emplace_back([this] { thread_exec(); });
+
+    Log::i("Synth worker pool: %u threads", thread_count);
+}
+
+Synth_Worker_Pool::~Synth_Worker_Pool()
+{
+    quit_.store(true);
+    wake_.post((unsigned)threads_.size());
+
+    for (std::thread &thread : threads_)
+        thread.join();
+}
+
+unsigned Synth_Worker_Pool::default_thread_count()
+{
+    // one core is left for the caller, which participates in the batch
+    unsigned cores = std::thread::hardware_concurrency();
+    return (cores > 1) ? std::min(cores - 1, max_worker_threads) : 0;
+}
+
+void Synth_Worker_Pool::run_jobs(const synth_job *jobs, size_t count)
+{
+    if (count == 0)
+        return;
+
+    // run inline if no help is available, or if another batch is running
+    if (threads_.empty() || count == 1 || busy_.exchange(true)) {
+        for (size_t i = 0; i < count; ++i)
+            jobs[i].function(jobs[i].data);
+        return;
+    }
+
+    Batch batch;
+    batch.jobs = jobs;
+    batch.count = count;
+    batch.priority = get_thread_realtime();
+
+    // wake no more workers than there are jobs left after the caller's own
+    batch_.store(&batch);
+    wake_.post((unsigned)std::min(count - 1, threads_.size()));
+
+    execute(batch);
+
+    while (batch.done.load(std::memory_order_acquire) < count)
+        std::this_thread::yield();
+
+    batch_.store(nullptr);
+
+    // wait for the workers to release the batch before it goes out of scope
+    while (batch_users_.load(std::memory_order_acquire) > 0)
+        std::this_thread::yield();
+
+    busy_.store(false);
+}
+
+void Synth_Worker_Pool::execute(Batch &batch)
+{
+    size_t index;
+    while ((index = batch.next.fetch_add(1)) < batch.count) {
+        const synth_job &job = batch.jobs[index];
+        job.function(job.data);
+        batch.done.fetch_add(1, std::memory_order_release);
+    }
+}
+
+void Synth_Worker_Pool::thread_exec()
+{
+    // the workers are left to the scheduler to place, but they must run at
+    //   the priority of the caller, which would otherwise spin waiting for
+    //   them while they get preempted
+    int priority = 0;
+
+    for (;;) {
+        wake_.wait();
+        if (quit_.load())
+            break;
+
+        // register before looking at the batch, so the caller, which clears
+        //   it before waiting for the users to leave, cannot free it under us;
+        //   a late wake-up finds no batch, or a later one, and is harmless
+        batch_users_.fetch_add(1);
+        Batch *batch = batch_.load();
+        if (!batch) {
+            batch_users_.fetch_sub(1, std::memory_order_release);
+            continue;
+        }
+
+        if (batch->priority > priority) {
+            set_thread_realtime(batch->priority);
+            priority = batch->priority;
+        }
+
+        execute(*batch);
+        batch_users_.fetch_sub(1, std::memory_order_release);
+    }
+}
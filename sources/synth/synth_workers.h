@@ -0,0 +1,52 @@
+//          Copyright Jean Pierre Cimalando 2019-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#include "synth.h"
+#include "utility/semaphore.h"
+#include <thread>
+#include <atomic>
+#include <vector>
+
+class Synth_Worker_Pool {
+public:
+    explicit Synth_Worker_Pool(unsigned thread_count);
+    ~Synth_Worker_Pool();
+
+    static unsigned default_thread_count();
+
+    unsigned worker_count() const noexcept { return (unsigned)threads_.size() + 1; }
+    void run_jobs(const synth_job *jobs, size_t count);
+
+private:
+    Synth_Worker_Pool(const Synth_Worker_Pool &) = delete;
+    Synth_Worker_Pool &operator=(const Synth_Worker_Pool &) = delete;
+
+private:
+    struct Batch {
+        const synth_job *jobs = nullptr;
+        size_t count = 0;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        // real-time priority of the caller, which the workers adopt
+        int priority = 0;
+    };
+
+    void thread_exec();
+    static void execute(Batch &batch);
+
+private:
+    std::vector<std::thread> threads_;
+
+    // the caller wakes the workers without taking a lock
+    Semaphore wake_;
+    std::atomic_bool quit_{false};
+    std::atomic<Batch *> batch_{nullptr};
+
+    // whether a batch is in progress
+    std::atomic_bool busy_{false};
+    // number of workers which reference the current batch
+    std::atomic<unsigned> batch_users_{0};
+};
@@ -244,6 +244,29 @@ int filemode_utf8(const char *path)
     return st.st_mode;
 }
 
+bool filestat_utf8(const char *path, long long *size, long long *mtime)
+{
+#ifndef _WIN32
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return false;
+#else
+    struct _stat64 st;
+    std::wstring wpath;
+    if (!convert_utf<char, wchar_t>(path, wpath, false)) {
+        errno = EINVAL;
+        return false;
+    }
+    if (_wstat64(wpath.c_str(), &st) != 0)
+        return false;
+#endif
+    if (size)
+        *size = (long long)st.st_size;
+    if (mtime)
+        *mtime = (long long)st.st_mtime;
+    return true;
+}
+
 bool make_directory(nonstd::string_view path)
 {
 #ifndef _WIN32
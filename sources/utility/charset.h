@@ -23,6 +23,7 @@ std::string utf8_collation_key(nonstd::string_view src);
 // file I/O
 FILE *fopen_utf8(const char *path, const char *mode);
 int filemode_utf8(const char *path);
+bool filestat_utf8(const char *path, long long *size, long long *mtime);
 
 // directories
 bool make_directory(nonstd::string_view path);
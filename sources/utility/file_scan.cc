@@ -5,6 +5,7 @@
 
 #include "file_scan.h"
 #include "paths.h"
+#include "thread_priority.h"
 #include <nonstd/scope.hpp>
 
 File_Scan::File_Scan(
@@ -82,6 +83,9 @@ bool File_Scan::wait_for_file_count(size_t count, std::chrono::milliseconds time
 
 void File_Scan::scan_in_thread()
 {
+    // the scan must not compete with playback for the disk or the CPU
+    set_thread_idle();
+
 #if PORTFTS_HAVE_FTS
     int fts_flags = pFTS_LOGICAL;
 #else
@@ -0,0 +1,84 @@
+//          Copyright Jean Pierre Cimalando 2019-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "utility/semaphore.h"
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+#include <climits>
+#include <cerrno>
+#include <system_error>
+
+#if defined(_WIN32)
+Semaphore::Semaphore(unsigned value)
+{
+    handle_ = CreateSemaphoreW(nullptr, (LONG)value, LONG_MAX, nullptr);
+    if (!handle_)
+        throw std::system_error((int)GetLastError(), std::system_category());
+}
+
+Semaphore::~Semaphore()
+{
+    CloseHandle(handle_);
+}
+
+void Semaphore::post(unsigned count)
+{
+    if (count > 0)
+        ReleaseSemaphore(handle_, (LONG)count, nullptr);
+}
+
+void Semaphore::wait()
+{
+    WaitForSingleObject(handle_, INFINITE);
+}
+#elif defined(__APPLE__)
+Semaphore::Semaphore(unsigned value)
+{
+    // the unnamed POSIX semaphores are not implemented on this system
+    handle_ = dispatch_semaphore_create((long)value);
+    if (!handle_)
+        throw std::system_error(ENOMEM, std::generic_category());
+}
+
+Semaphore::~Semaphore()
+{
+    dispatch_release(handle_);
+}
+
+void Semaphore::post(unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i)
+        dispatch_semaphore_signal(handle_);
+}
+
+void Semaphore::wait()
+{
+    dispatch_semaphore_wait(handle_, DISPATCH_TIME_FOREVER);
+}
+#else
+Semaphore::Semaphore(unsigned value)
+{
+    if (sem_init(&handle_, 0, value) != 0)
+        throw std::system_error(errno, std::generic_category());
+}
+
+Semaphore::~Semaphore()
+{
+    sem_destroy(&handle_);
+}
+
+void Semaphore::post(unsigned count)
+{
+    for (unsigned i = 0; i < count; ++i)
+        sem_post(&handle_);
+}
+
+void Semaphore::wait()
+{
+    while (sem_wait(&handle_) != 0 && errno == EINTR)
+        continue;
+}
+#endif
@@ -0,0 +1,35 @@
+//          Copyright Jean Pierre Cimalando 2019-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+#if defined(_WIN32)
+typedef void *Semaphore_Handle;
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+typedef dispatch_semaphore_t Semaphore_Handle;
+#else
+#include <semaphore.h>
+typedef sem_t Semaphore_Handle;
+#endif
+
+/**
+ * Counting semaphore on the primitive of the system, which can be posted
+ * from a real-time thread without taking a lock.
+ */
+class Semaphore {
+public:
+    explicit Semaphore(unsigned value = 0);
+    ~Semaphore();
+
+    void post(unsigned count = 1);
+    void wait();
+
+private:
+    Semaphore(const Semaphore &) = delete;
+    Semaphore &operator=(const Semaphore &) = delete;
+
+private:
+    Semaphore_Handle handle_;
+};
@@ -0,0 +1,119 @@
+//          Copyright Jean Pierre Cimalando 2019-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "utility/thread_priority.h"
+#include "utility/logs.h"
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <cstring>
+#include <cerrno>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+
+#if defined(_WIN32)
+bool set_thread_realtime(int priority)
+{
+    int level = (priority >= 50) ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST;
+    if (!SetThreadPriority(GetCurrentThread(), level)) {
+        Log::w("Cannot set the real-time priority of the thread");
+        return false;
+    }
+    return true;
+}
+
+int get_thread_realtime()
+{
+    int level = GetThreadPriority(GetCurrentThread());
+    if (level == THREAD_PRIORITY_TIME_CRITICAL)
+        return 50;
+    if (level == THREAD_PRIORITY_HIGHEST)
+        return 1;
+    return 0;
+}
+
+bool set_thread_idle()
+{
+    // lowers the I/O priority together with the CPU priority
+    return SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+}
+
+bool lock_process_memory()
+{
+    Log::w("Cannot lock the process memory on this system");
+    return false;
+}
+#else
+bool set_thread_realtime(int priority)
+{
+    int policy = SCHED_FIFO;
+    sched_param param {};
+    param.sched_priority = std::max(sched_get_priority_min(policy),
+                                    std::min(sched_get_priority_max(policy), priority));
+
+    int err = pthread_setschedparam(pthread_self(), policy, &param);
+    if (err != 0) {
+        Log::w("Cannot set the real-time priority of the thread: %s", std::strerror(err));
+        return false;
+    }
+    return true;
+}
+
+int get_thread_realtime()
+{
+    int policy;
+    sched_param param {};
+    if (pthread_getschedparam(pthread_self(), &policy, &param) != 0)
+        return 0;
+    if (policy != SCHED_FIFO && policy != SCHED_RR)
+        return 0;
+    return param.sched_priority;
+}
+
+bool set_thread_idle()
+{
+    bool success = true;
+
+#if defined(__linux__)
+    sched_param param {};
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+        success = false;
+
+    // the ioprio interface has no wrapper in the C library
+    const int ioprio_who_process = 1;
+    const int ioprio_class_idle = 3;
+    const int ioprio_class_shift = 13;
+    if (syscall(SYS_ioprio_set, ioprio_who_process, 0, ioprio_class_idle << ioprio_class_shift) != 0)
+        success = false;
+#else
+    int policy;
+    sched_param param {};
+    if (pthread_getschedparam(pthread_self(), &policy, &param) == 0) {
+        param.sched_priority = sched_get_priority_min(policy);
+        success = pthread_setschedparam(pthread_self(), policy, &param) == 0;
+    }
+    else
+        success = false;
+#endif
+
+    return success;
+}
+
+bool lock_process_memory()
+{
+    if (mlockall(MCL_CURRENT|MCL_FUTURE) != 0) {
+        Log::w("Cannot lock the process memory: %s", std::strerror(errno));
+        return false;
+    }
+    return true;
+}
+#endif
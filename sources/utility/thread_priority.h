@@ -0,0 +1,28 @@
+//          Copyright Jean Pierre Cimalando 2019-2022.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE.md or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+/**
+ * Raise the calling thread to real-time scheduling, at a priority in the
+ * range 1 to 99.
+ */
+bool set_thread_realtime(int priority);
+
+/**
+ * Get the real-time priority of the calling thread, or 0 if it does not have
+ * real-time scheduling.
+ */
+int get_thread_realtime();
+
+/**
+ * Lower the calling thread to the idle class, for both the CPU and the I/O.
+ */
+bool set_thread_idle();
+
+/**
+ * Keep all the memory of the process resident, present and future.
+ */
+bool lock_process_memory();